@@ -1,35 +1,105 @@
 #ifndef LAMBDIFIER_JIT_HPP
 #define LAMBDIFIER_JIT_HPP
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include <llvm/Config/llvm-config.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
 #include <llvm/ExecutionEngine/JITSymbol.h>
+#include <llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h>
 #include <llvm/ExecutionEngine/Orc/Core.h>
 #include <llvm/ExecutionEngine/Orc/IRCompileLayer.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LazyReexports.h>
 #include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
 #include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Target/TargetMachine.h>
 
+#include <lambdifier/detail/object_cache.hpp>
 #include <lambdifier/detail/visibility.hpp>
 
 namespace lambdifier::detail
 {
 
+// NOTE: the JIT is thread-safe: modules can be added, looked up
+// and released concurrently from multiple threads. The only
+// exceptions are the setters (apart from the ones for the
+// debugger and profiler support), which must not be invoked
+// concurrently with other member functions.
 class jit
 {
+public:
+    // Identifier of a unit of compiled code (i.e., of
+    // the code added to the JIT via a call to add_module()).
+    using unit_id = std::uint64_t;
+
+    // Time spent generating the machine code of a unit
+    // and linking it (summed over all the objects of the unit).
+    struct unit_timings {
+        std::chrono::nanoseconds codegen{};
+        std::chrono::nanoseconds link{};
+    };
+
+private:
+    // Memory manager which can release the memory
+    // it allocated before the destruction of the JIT.
+    class memory_manager;
+
+    // Book-keeping for a unit of compiled code.
+    struct unit {
+        // The names of the symbols defined by the unit.
+        std::vector<std::string> names;
+        // For each partition of the unit, the name of a visible
+        // symbol whose lookup materialises the partition.
+        std::vector<std::string> part_syms;
+        // Flag signalling if the unit was added in lazy mode.
+        bool lazy = false;
+    };
+
     llvm::orc::ExecutionSession es;
     llvm::orc::RTDyldObjectLinkingLayer object_layer;
+    // NOTE: the cache must outlive the compile layer.
+    object_cache obj_cache;
     std::unique_ptr<llvm::orc::IRCompileLayer> compile_layer;
+    // Machinery for the lazy compilation mode.
+    std::unique_ptr<llvm::orc::LazyCallThroughManager> lctm;
+    std::unique_ptr<llvm::orc::CompileOnDemandLayer> cod_layer;
+    std::unique_ptr<llvm::orc::JITTargetMachineBuilder> jtmb_copy;
     std::unique_ptr<llvm::DataLayout> dl;
     std::unique_ptr<llvm::orc::MangleAndInterner> mangle;
-    llvm::orc::ThreadSafeContext ctx;
 #if LLVM_VERSION_MAJOR == 10
     llvm::orc::JITDylib &main_jd;
 #endif
+    // The names of the symbols defined
+    // in the modules added to the JIT, and
+    // the units of compiled code.
+    std::unordered_set<std::string> sym_names;
+    std::unordered_map<unit_id, unit> units;
+    mutable std::mutex sym_names_mutex;
+    // The memory managers holding the code and data of each unit.
+    std::unordered_map<unit_id, std::vector<memory_manager *>> unit_mms;
+    mutable std::mutex mms_mutex;
+    std::atomic<bool> lazy = false;
+    // The event listeners for the debugger and the profiler,
+    // and the key of the next object to be loaded.
+    // NOTE: these are protected by mms_mutex, as they are
+    // accessed when the objects are loaded.
+    llvm::JITEventListener *gdb_listener = nullptr;
+    llvm::JITEventListener *perf_listener = nullptr;
+    llvm::JITEventListener::ObjectKey next_obj_key = 0;
 
 public:
     jit();
@@ -41,11 +111,29 @@ public:
 
     ~jit();
 
-    llvm::LLVMContext &get_context();
-
     const llvm::DataLayout &get_data_layout() const;
+    std::string get_target_triple() const;
+    std::unique_ptr<llvm::TargetMachine> create_target_machine(bool = false) const;
+
+    unit_id add_module(llvm::orc::ThreadSafeContext, std::unique_ptr<llvm::Module> &&, unsigned = 1,
+                       const std::vector<std::pair<std::string, std::string>> & = {});
+    void release(unit_id);
+    void materialize(unit_id);
+    unit_timings get_unit_timings(unit_id);
+    bool has_unit(unit_id) const;
+    bool has_symbol(const std::string &) const;
+    void add_alias(const std::string &, const std::string &);
+
+    std::string get_object_cache_dir() const;
+    void set_object_cache_dir(std::string);
+
+    bool get_lazy() const;
+    void set_lazy(bool);
 
-    void add_module(std::unique_ptr<llvm::Module> &&);
+    bool get_gdb_support() const;
+    void set_gdb_support(bool);
+    bool get_perf_support() const;
+    void set_perf_support(bool);
 
     llvm::Expected<llvm::JITEvaluatedSymbol> lookup(const std::string &);
 };
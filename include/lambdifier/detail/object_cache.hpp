@@ -0,0 +1,56 @@
+#ifndef LAMBDIFIER_DETAIL_OBJECT_CACHE_HPP
+#define LAMBDIFIER_DETAIL_OBJECT_CACHE_HPP
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+namespace lambdifier::detail
+{
+
+// Hash of the IR of a module, independent of the
+// identifier and of the source file name of the module.
+std::string ir_hash(const llvm::Module &);
+
+// On-disk cache for the object files produced by the JIT.
+// The objects are stored in a user-provided directory, and they
+// are keyed by a hash of the IR of the module (see ir_hash()) and of the
+// target identifier (triple, CPU, features and codegen
+// optimisation level). The cache is disabled if the
+// directory is empty (which is the default).
+class object_cache final : public llvm::ObjectCache
+{
+    std::string dir;
+    std::string target_id;
+    // Keys of the modules currently being compiled.
+    std::unordered_map<const llvm::Module *, std::string> keys;
+    mutable std::mutex mutex;
+
+    std::string compute_key(const llvm::Module *) const;
+
+public:
+    object_cache();
+
+    object_cache(const object_cache &) = delete;
+    object_cache(object_cache &&) = delete;
+    object_cache &operator=(const object_cache &) = delete;
+    object_cache &operator=(object_cache &&) = delete;
+
+    ~object_cache() override;
+
+    std::string get_dir() const;
+    void set_dir(std::string);
+    void set_target_id(std::string);
+
+    void notifyObjectCompiled(const llvm::Module *, llvm::MemoryBufferRef) override;
+    std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *) override;
+};
+
+} // namespace lambdifier::detail
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef LAMBDIFIER_DETAIL_PIPELINE_HPP
+#define LAMBDIFIER_DETAIL_PIPELINE_HPP
+
+#include <string>
+
+#include <llvm/Analysis/CGSCCPassManager.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Target/TargetMachine.h>
+
+namespace lambdifier::detail
+{
+
+// Function-level optimisation pipeline selected by the user,
+// built on top of LLVM's new pass manager. The pipeline is either
+// one of the presets "O0", "cleanup", "O1", "O2", "O3" and "taylor", or
+// a function pass pipeline in the textual format of the new pass manager
+// (e.g., "instcombine,gvn").
+// NOTE: before running the pipeline on a function, the calls to the
+// other functions defined in the module are inlined, so that the
+// function can be optimised in isolation. The function is then marked
+// so that it is skipped by run_module_pm().
+class fn_pipeline
+{
+    std::string name;
+    // NOTE: the analysis managers must be
+    // declared before the pass manager.
+    llvm::LoopAnalysisManager lam;
+    llvm::FunctionAnalysisManager fam;
+    llvm::CGSCCAnalysisManager cam;
+    llvm::ModuleAnalysisManager mam;
+    llvm::FunctionPassManager fpm;
+
+public:
+    // NOTE: tm must outlive the pipeline.
+    fn_pipeline(llvm::TargetMachine &, std::string);
+
+    fn_pipeline(const fn_pipeline &) = delete;
+    fn_pipeline(fn_pipeline &&) = delete;
+    fn_pipeline &operator=(const fn_pipeline &) = delete;
+    fn_pipeline &operator=(fn_pipeline &&) = delete;
+
+    ~fn_pipeline();
+
+    const std::string &get_name() const;
+
+    void run(llvm::Function &);
+};
+
+// Check if f was optimised by a fn_pipeline.
+bool has_fn_pipeline(const llvm::Function &);
+
+// Run the module-level optimizer pm on m, skipping
+// the functions optimised by a fn_pipeline.
+void run_module_pm(llvm::legacy::PassManager &, llvm::Module &);
+
+} // namespace lambdifier::detail
+
+#endif
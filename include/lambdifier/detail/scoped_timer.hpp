@@ -0,0 +1,32 @@
+#ifndef LAMBDIFIER_DETAIL_SCOPED_TIMER_HPP
+#define LAMBDIFIER_DETAIL_SCOPED_TIMER_HPP
+
+#include <chrono>
+
+namespace lambdifier::detail
+{
+
+// Simple RAII timer: on destruction, it adds
+// the time elapsed since construction to acc.
+class scoped_timer
+{
+    std::chrono::nanoseconds &acc;
+    const std::chrono::steady_clock::time_point start;
+
+public:
+    explicit scoped_timer(std::chrono::nanoseconds &a) : acc(a), start(std::chrono::steady_clock::now()) {}
+
+    scoped_timer(const scoped_timer &) = delete;
+    scoped_timer(scoped_timer &&) = delete;
+    scoped_timer &operator=(const scoped_timer &) = delete;
+    scoped_timer &operator=(scoped_timer &&) = delete;
+
+    ~scoped_timer()
+    {
+        acc += std::chrono::steady_clock::now() - start;
+    }
+};
+
+} // namespace lambdifier::detail
+
+#endif
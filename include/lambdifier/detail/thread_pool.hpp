@@ -0,0 +1,86 @@
+#ifndef LAMBDIFIER_DETAIL_THREAD_POOL_HPP
+#define LAMBDIFIER_DETAIL_THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace lambdifier::detail
+{
+
+// Work-stealing thread pool for the parallel
+// evaluation of ranges of points.
+// NOTE: parallel_for() splits the range into chunks, and each thread
+// (including the calling one) is assigned a contiguous block of chunks
+// in its own queue. A thread processes its queue from the front, and
+// when the queue is empty it steals chunks from the back of the queues
+// of the other threads, so that the load is balanced even if the cost
+// of the evaluation is not uniform across the range.
+// NOTE: parallel_for() must not be invoked concurrently
+// from multiple threads on the same pool.
+class thread_pool
+{
+    using range_t = std::pair<std::uint64_t, std::uint64_t>;
+    using job_t = std::function<void(std::uint64_t, std::uint64_t)>;
+
+    struct work_queue {
+        std::mutex m;
+        std::deque<range_t> ranges;
+    };
+
+    // The worker threads, and the queues (one per worker,
+    // plus one for the thread invoking parallel_for()).
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<work_queue>> queues;
+    // Synchronisation between parallel_for() and the workers:
+    // the job being executed, the generation of the job (bumped
+    // at each invocation of parallel_for()), the number of workers
+    // still busy with the current job and the stop flag.
+    std::mutex m;
+    std::condition_variable start_cv, done_cv;
+    const job_t *job = nullptr;
+    std::uint64_t generation = 0;
+    unsigned n_active = 0;
+    bool stop = false;
+    // Error handling: the first exception thrown by
+    // the job, and the flag to skip the remaining chunks.
+    std::exception_ptr eptr;
+    std::atomic<bool> failed = false;
+
+    std::optional<range_t> pop(unsigned);
+    void run(unsigned);
+    void worker_main(unsigned);
+
+public:
+    // NOTE: n is the total number of threads used by
+    // parallel_for(), including the calling one.
+    explicit thread_pool(unsigned);
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool(thread_pool &&) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+    thread_pool &operator=(thread_pool &&) = delete;
+
+    ~thread_pool();
+
+    unsigned get_n_threads() const;
+
+    // Invoke f(begin, end) on the chunks of size chunk_size (the last one
+    // may be smaller) of the range [0, n), and wait for the completion.
+    // If f throws, the remaining chunks are skipped and the first
+    // exception is re-thrown.
+    void parallel_for(std::uint64_t, std::uint64_t, const job_t &);
+};
+
+} // namespace lambdifier::detail
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef LAMBDIFIER_DETAIL_VECTOR_MATH_HPP
+#define LAMBDIFIER_DETAIL_VECTOR_MATH_HPP
+
+#include <string>
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Type.h>
+
+namespace lambdifier::detail
+{
+
+// Fetch from the module m the vectorised implementation of the
+// elementary function name for the vector of doubles type vt, creating
+// it if needed. The supported functions are "exp", "log", "sin" and "cos".
+// Returns null if name or the type are not supported.
+// NOTE: the implementations are based on the Cephes library, and they
+// are accurate to a few ULPs. The argument reduction of sin() and cos()
+// is accurate only up to |x| = 2**30: if any element of the vector is
+// larger than that, the whole vector is evaluated via the scalar sin()
+// and cos() of the system math library.
+llvm::Function *vector_math_function(llvm::Module &, const std::string &, llvm::Type *);
+
+} // namespace lambdifier::detail
+
+#endif
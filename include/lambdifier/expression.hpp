@@ -2,6 +2,7 @@
 #define LAMBDIFIER_EXPRESSION_HPP
 
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <ostream>
@@ -175,6 +176,8 @@ public:
     // Comparison operators: note that 1+x will be not equal to x+1. Trees will be compared node by node.
     bool operator==(const expression &other) const;
     bool operator!=(const expression &other) const;
+    // Structural hash, consistent with operator==().
+    std::size_t hash() const;
     // Call operators on double. Normal and batch version
     double operator()(std::unordered_map<std::string, double> &) const;
     void operator()(std::unordered_map<std::string, std::vector<double>> &, std::vector<double> &) const;
@@ -242,6 +245,11 @@ public:
     }
 
     std::vector<std::string> get_variables() const;
+    // The size of the array of the parameter values required to
+    // evaluate the expression, that is, the largest index of the
+    // parameters in the expression plus one (0 if the expression
+    // does not contain parameters).
+    std::uint64_t get_n_params() const;
 };
 
 LAMBDIFIER_DLL_PUBLIC expression operator+(expression, expression);
@@ -1,15 +1,20 @@
 #ifndef LAMBDIFIER_LLVM_STATE_HPP
 #define LAMBDIFIER_LLVM_STATE_HPP
 
+#include <array>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <future>
 #include <memory>
 #include <optional>
 #include <string>
 #include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Instruction.h>
@@ -17,6 +22,7 @@
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Value.h>
+#include <llvm/Target/TargetMachine.h>
 
 // NOTE: expression coming from fwd_decl.hpp
 // in order to avoid circular deps.
@@ -27,9 +33,62 @@
 namespace lambdifier
 {
 
+namespace detail
+{
+
+class fn_pipeline;
+class thread_pool;
+
+} // namespace detail
+
+// NOTE: an llvm_state must not be used concurrently from multiple
+// threads. In order to generate and compile code from multiple threads,
+// it is possible to create sibling states (that is, states sharing the
+// same JIT session) via the constructor taking an llvm_state as second
+// argument, and to use each sibling from a different thread.
+// The functions compiled by any sibling can be fetched from
+// all the siblings. The JIT-related settings (i.e., the object cache
+// directory and lazy mode) are shared among siblings, and they
+// must not be changed while other siblings are in use.
 class LAMBDIFIER_DLL_PUBLIC llvm_state
 {
-    detail::jit jitter;
+public:
+    // The losses computed by the loss kernels: sum of the squared
+    // errors, mean absolute error and maximum absolute error.
+    enum class loss_type { sse, mae, max_abs };
+
+    // Timing statistics for an invocation of compile().
+    struct compile_stats {
+        // Time spent building the IR (i.e., in add_expression()
+        // and add_taylor(), excluding the optimisation passes).
+        std::chrono::nanoseconds ir_build{};
+        // Time spent in the function-level and
+        // module-level optimisation passes.
+        std::chrono::nanoseconds fn_opt{};
+        std::chrono::nanoseconds module_opt{};
+        // Time spent generating the machine code and
+        // linking it, summed over all the compile threads.
+        // NOTE: these are measured only when profiling is enabled.
+        std::chrono::nanoseconds codegen{};
+        std::chrono::nanoseconds link{};
+        // Per-pass timing report from LLVM (only when profiling is enabled).
+        std::string pass_timings;
+    };
+
+private:
+    // Book-keeping for the deduplication of the expressions,
+    // and for the modules being compiled asynchronously.
+    struct dedup_entry;
+    struct async_unit;
+
+    std::shared_ptr<detail::jit> jitter;
+    // The target machine used to set up the
+    // target-specific optimisation passes.
+    std::unique_ptr<llvm::TargetMachine> tm;
+    // NOTE: each module lives in its own context, so that the
+    // JIT can compile it while we generate code for the next module.
+    llvm::orc::ThreadSafeContext ctx;
+    std::string module_name;
     std::unique_ptr<llvm::Module> module;
     std::unique_ptr<llvm::IRBuilder<>> builder;
     std::unique_ptr<llvm::legacy::FunctionPassManager> fpm;
@@ -37,12 +96,90 @@ class LAMBDIFIER_DLL_PUBLIC llvm_state
     std::unordered_map<std::string, llvm::Value *> named_values;
     bool verify = true;
     unsigned opt_level;
+    // The function-level optimisation pipeline selected
+    // by the user (null if not set).
+    std::unique_ptr<detail::fn_pipeline> fn_pl;
+    // The pipelines for the automatically-selected
+    // optimisation levels (created on demand).
+    std::array<std::unique_ptr<detail::fn_pipeline>, 4> auto_pls;
+    bool verbose = false;
+    unsigned compile_threads = 1;
+    std::string target_cpu;
+    std::string target_features;
+    bool batch_multiversioning = false;
+    bool batch_soa = false;
+    bool batch_strided = false;
+    bool single_precision = false;
+    bool loss_kernels = false;
+    unsigned simd_width = 1;
+    // The number of lanes of the values being
+    // generated by the codegen of the expressions.
+    unsigned cg_width = 1;
+    // Whether the functions being generated take the array
+    // of the parameter values as last argument, and the array
+    // in the function being generated (null if none).
+    bool with_params = false;
+    llvm::Value *param_values = nullptr;
+    bool profiling = false;
+    // The statistics for the current module
+    // and for the last compile() invocation.
+    compile_stats cur_stats;
+    compile_stats last_stats;
+    // The expressions added via add_expression(), indexed
+    // by hash, the entries for the expressions in the current
+    // module, and the aliases to be defined in the JIT when
+    // the current module is compiled.
+    std::unordered_multimap<std::size_t, std::unique_ptr<dedup_entry>> dedup_map;
+    std::vector<dedup_entry *> module_entries;
+    std::vector<std::pair<std::string, std::string>> pending_aliases;
+    // The modules handed over to compile_async().
+    std::vector<std::shared_ptr<async_unit>> async_units;
+    // Parallel evaluation: the number of threads, the chunk size (0
+    // for automatic), the thread pool (created on demand) and the number
+    // of variables of the expressions added via add_expression().
+    unsigned eval_threads;
+    std::uint64_t eval_chunk_size = 0;
+    std::unique_ptr<detail::thread_pool> pool;
+    std::unordered_map<std::string, std::size_t> expression_n_vars;
 
+    LAMBDIFIER_DLL_LOCAL llvm_state(const std::string &, std::shared_ptr<detail::jit>, unsigned);
+
+    LAMBDIFIER_DLL_LOCAL void reset_module();
+    LAMBDIFIER_DLL_LOCAL void check_name_availability(const std::string &) const;
+    LAMBDIFIER_DLL_LOCAL void set_target_attributes(llvm::Function &) const;
+    LAMBDIFIER_DLL_LOCAL void optimize_function(llvm::Function &);
+    LAMBDIFIER_DLL_LOCAL void optimize_function(llvm::Function &, detail::fn_pipeline *);
+    LAMBDIFIER_DLL_LOCAL std::optional<std::size_t> select_pipeline_level(const expression &,
+                                                                           unsigned long long) const;
     LAMBDIFIER_DLL_LOCAL void add_varargs_expression(const std::string &, const expression &,
                                                      const std::vector<std::string> &);
     LAMBDIFIER_DLL_LOCAL void add_vecargs_expression(const std::string &, const std::vector<std::string> &);
     LAMBDIFIER_DLL_LOCAL void add_batch_expression(const std::string &, const std::vector<std::string> &, unsigned);
+    LAMBDIFIER_DLL_LOCAL void add_batch_soa_expression(const std::string &, const std::vector<std::string> &,
+                                                       unsigned);
+    LAMBDIFIER_DLL_LOCAL void add_batch_n_expression(const std::string &, const expression &,
+                                                     const std::vector<std::string> &, bool);
+    LAMBDIFIER_DLL_LOCAL void add_multi_expression(const std::string &, const std::vector<expression> &,
+                                                   const std::vector<std::string> &);
+    LAMBDIFIER_DLL_LOCAL void add_multi_batch_expression(const std::string &, std::uint64_t, std::uint64_t, unsigned);
+    LAMBDIFIER_DLL_LOCAL void add_batch_strided_expression(const std::string &, const std::vector<std::string> &,
+                                                           bool);
+    LAMBDIFIER_DLL_LOCAL void register_n_vars(const std::string &, std::size_t);
+    LAMBDIFIER_DLL_LOCAL void add_loss_expression(const std::string &, const expression &,
+                                                  const std::vector<std::string> &, loss_type);
+    LAMBDIFIER_DLL_LOCAL llvm::Value *codegen_simd_points(const expression &, const std::vector<std::string> &, bool,
+                                                          llvm::Value *, llvm::Value *, llvm::Value *);
+    LAMBDIFIER_DLL_LOCAL unsigned get_fp_align() const;
+    LAMBDIFIER_DLL_LOCAL void add_param_arg(std::vector<llvm::Type *> &);
+    LAMBDIFIER_DLL_LOCAL llvm::Value *setup_param_arg(llvm::Function &);
+    LAMBDIFIER_DLL_LOCAL void add_batch_variants(const std::string &, detail::fn_pipeline *);
+    LAMBDIFIER_DLL_LOCAL void add_batch_variants(llvm::Function &, detail::fn_pipeline *);
+    LAMBDIFIER_DLL_LOCAL bool add_duplicate(const std::string &, const expression &, unsigned, const std::string &,
+                                            std::size_t);
+    LAMBDIFIER_DLL_LOCAL void add_aliases(const std::string &, const std::string &);
+    LAMBDIFIER_DLL_LOCAL llvm::Function *get_function(const std::string &) const;
     std::uintptr_t jit_lookup(const std::string &);
+    LAMBDIFIER_DLL_LOCAL std::uintptr_t jit_lookup_variant(const std::string &);
     LAMBDIFIER_DLL_LOCAL void add_llvm_inst_to_value_exp_map(std::unordered_map<const llvm::Value *, expression> &,
                                                              const llvm::Instruction &,
                                                              std::optional<expression> &) const;
@@ -51,6 +188,7 @@ class LAMBDIFIER_DLL_PUBLIC llvm_state
 
 public:
     explicit llvm_state(const std::string &, unsigned = 3);
+    llvm_state(const std::string &, const llvm_state &, unsigned = 3);
 
     llvm_state(const llvm_state &) = delete;
     llvm_state(llvm_state &&) = delete;
@@ -59,29 +197,315 @@ public:
 
     ~llvm_state();
 
-    void add_expression(const std::string &, const expression &, unsigned = 0);
+    // NOTE: in addition to the batch function for the batch size passed
+    // as third argument (if nonzero), add_expression() always generates a
+    // batch function taking the number of evaluations as a runtime
+    // argument (see fetch_batch_n()).
+    // NOTE: the last argument is the expected number of evaluations of
+    // the expression (0, the default, means unknown). If provided, and if
+    // no pipeline was selected via set_opt_pipeline(), the optimisation
+    // level for the expression is chosen automatically from the hint and
+    // from the size of the expression, so that large expressions which are
+    // evaluated only a few times do not spend more time in the optimiser
+    // than at runtime. The automatic level never exceeds the opt level of
+    // the state (thus, no optimisation is run at opt level 0).
+    // NOTE: if an identical expression (with the same batch size, code
+    // generation settings and optimisation pipeline) was already added to
+    // the state, no new code is generated: name becomes an alias of the
+    // existing functions. An alias is released together with the unit of the
+    // functions it refers to.
+    // NOTE: if the expression contains parameters (see the param class),
+    // all the functions generated for it take the array of the parameter
+    // values as last argument, and they must be fetched via the "_par"
+    // versions of the fetch functions (e.g., fetch_batch_n_par()).
+    // Parameters are available only in double precision.
+    void add_expression(const std::string &, const expression &, unsigned = 0, unsigned long long = 0);
+    // Add a fused kernel evaluating all the expressions in the vector
+    // at the same points, so that the input is loaded only once and the
+    // subexpressions shared among the expressions are computed only
+    // once. The variables of the kernel are the variables of all the
+    // expressions, in alphabetical order. The kernel can be fetched
+    // via fetch_multi(), and the batch versions via fetch_batch() (if the
+    // batch size passed as third argument is nonzero) and fetch_batch_n().
+    // The outputs of the batch versions are in AoS layout, that is, the
+    // values of all the expressions for the first point, followed by the
+    // values for the second point, etc.
+    // NOTE: the kernels are not deduplicated, and SoA and SIMD
+    // versions of the batch functions are not generated. The
+    // expressions cannot contain parameters.
+    void add_expressions(const std::string &, const std::vector<expression> &, unsigned = 0);
 
     llvm::LLVMContext &get_context();
     llvm::IRBuilder<> &get_builder();
     std::unordered_map<std::string, llvm::Value *> &get_named_values();
+    // The array of the parameter values in the function being
+    // generated (null if the function does not take parameters).
+    llvm::Value *get_param_values();
     llvm::Module &get_module();
 
     bool get_verify() const;
     void set_verify(bool);
 
+    // If the number of compile threads n is greater than 1,
+    // compile() will split the module into n partitions,
+    // which will be compiled in parallel.
+    unsigned get_compile_threads() const;
+    void set_compile_threads(unsigned);
+
+    // Directory for the on-disk cache of compiled objects.
+    // An empty string (the default) disables the cache.
+    std::string get_object_cache_dir() const;
+    void set_object_cache_dir(std::string);
+
+    // The CPU and the features (in the LLVM format, e.g., "+avx2,+fma")
+    // targeted by the functions added to the state. Empty strings (the
+    // default) select the host CPU and its features. The settings apply
+    // to the functions added after the invocation of the setters.
+    const std::string &get_target_cpu() const;
+    void set_target_cpu(std::string);
+    const std::string &get_target_features() const;
+    void set_target_features(std::string);
+
+    // The function-level optimisation pipeline for the functions added
+    // to the state. An empty string (the default) selects the pipeline
+    // corresponding to the optimisation level of the state. Otherwise,
+    // the pipeline is either one of the presets "O0", "cleanup" (mem2reg,
+    // instcombine and simplifycfg), "O1", "O2", "O3" and "taylor", or a
+    // function pass pipeline in the textual format of LLVM's new pass
+    // manager (e.g., "instcombine,gvn"). The setting
+    // applies to the functions added after the invocation of the setter,
+    // so that each expression can be optimised differently.
+    // NOTE: the functions optimised with a user-selected pipeline do not
+    // go through the module-level optimisation in compile(). Instead, the
+    // functions they invoke are inlined before running the pipeline.
+    std::string get_opt_pipeline() const;
+    void set_opt_pipeline(std::string);
+
+    // If the structure-of-arrays (SoA) layout is enabled, add_expression()
+    // will also generate a batch function reading the input in SoA layout,
+    // which can be fetched via fetch_batch_soa(). The input of the SoA
+    // function is a variable-major block, that is, the values of the
+    // first variable for all the evaluations, followed by the values of the
+    // second variable, etc., so that the loads are contiguous. The SoA
+    // version of the runtime-length batch function is generated as
+    // well (see fetch_batch_soa_n()).
+    bool get_batch_soa() const;
+    void set_batch_soa(bool);
+
+    // If strided batches are enabled, add_expression() will also generate
+    // batch functions reading the input in place from existing buffers
+    // (see fetch_batch_strided() and fetch_batch_cols()), so that the data
+    // does not need to be copied into the dense layouts first.
+    bool get_batch_strided() const;
+    void set_batch_strided(bool);
+
+    // If loss kernels are enabled, add_expression() will also generate
+    // kernels which evaluate the expression on a set of points and return
+    // a loss with respect to target values (see fetch_loss()), so that the
+    // values of the expression are never stored in memory.
+    bool get_loss_kernels() const;
+    void set_loss_kernels(bool);
+
+    // If the SIMD width w is greater than 1, the runtime-length batch
+    // functions (see fetch_batch_n()) evaluate the expression on w points
+    // at a time, using vectors of w doubles in the IR, and the elementary
+    // functions exp(), log(), sin() and cos() (and the functions based
+    // on them) are computed via vectorised implementations bundled with
+    // lambdifier. The remaining points are evaluated one at a time.
+    // The width must be a power of 2 not greater than 16 (the default
+    // is 1).
+    // NOTE: the vectorised elementary functions are accurate to a few ULPs,
+    // and thus their results may differ slightly from the scalar ones.
+    unsigned get_simd_width() const;
+    void set_simd_width(unsigned);
+    // The number of lanes of the values to be generated by
+    // the codegen of the expressions (1 means scalar values).
+    unsigned get_codegen_width() const;
+
+    // In single-precision mode, the functions are generated for the float
+    // type instead of double, and they must be fetched via the "_float"
+    // versions of the fetch functions (e.g., fetch_batch_n_float()). The
+    // setting applies to the functions added after the invocation of the
+    // setter.
+    // NOTE: in single precision, the external functions are invoked
+    // with the suffix "f" appended to their names, following the convention
+    // of the C math library (e.g., tan() becomes tanf()), and the elementary
+    // functions always use the LLVM intrinsics (also in SIMD mode). The Taylor
+    // integrators and the parallel evaluation are available only in
+    // double precision.
+    bool get_single_precision() const;
+    void set_single_precision(bool);
+    // The floating-point type of the
+    // functions being generated.
+    llvm::Type *get_fp_type();
+
+    // In verbose mode, the state logs to std::clog
+    // the optimisation levels chosen automatically
+    // by add_expression().
+    bool get_verbose() const;
+    void set_verbose(bool);
+
+    // If batch multiversioning is enabled, add_expression() will also
+    // generate AVX2 and AVX-512 variants of the batch functions,
+    // and fetch_batch() and friends will return the best variant
+    // supported by the host CPU. Available only on x86-64.
+    bool get_batch_multiversioning() const;
+    void set_batch_multiversioning(bool);
+
+    // If profiling is enabled, compile() generates the machine code eagerly
+    // (unless in lazy mode), so that the statistics returned by
+    // get_compile_stats() include the codegen and linking times,
+    // and LLVM records the timing of each pass.
+    // NOTE: per-pass timing is a global setting in LLVM, thus
+    // profiling should not be enabled on multiple states
+    // which are used concurrently.
+    bool get_profiling() const;
+    void set_profiling(bool);
+    const compile_stats &get_compile_stats() const;
+
+    // Register the JIT-compiled functions with the GDB JIT interface
+    // and/or the perf jitdump interface, so that they are
+    // identified by name in the debugger and the profiler.
+    // The settings apply to the code compiled after the invocation
+    // of the setters, and they are shared among sibling states.
+    bool get_gdb_support() const;
+    void set_gdb_support(bool);
+    bool get_perf_support() const;
+    void set_perf_support(bool);
+
+    // In lazy mode, compile() does not generate machine code:
+    // the pointers returned by fetch() and friends point to stubs,
+    // and each function is compiled the first time it is invoked.
+    // Lazy mode is off by default.
+    bool get_lazy() const;
+    void set_lazy(bool);
+
     std::string dump() const;
     std::string dump_function(const std::string &) const;
 
-    void compile();
+    // NOTE: compile() hands over the current module to the JIT
+    // and replaces it with a new empty module, thus functions can be
+    // added and compiled again after a call to compile().
+    // The returned id identifies the code compiled by this call,
+    // which can be freed via release(). After release(), the pointers
+    // to the released functions must not be used any more, and
+    // their names become available again.
+    using unit_id = detail::jit::unit_id;
+    unit_id compile();
+    std::future<unit_id> compile_async();
+    void release(unit_id);
+
+    void emit_object(const std::string &);
+    std::string dump_c_header() const;
 
     using f_ptr = double (*)(const double *);
     f_ptr fetch(const std::string &);
 
     using f_batch_ptr = void (*)(double *, const double *);
     f_batch_ptr fetch_batch(const std::string &);
+    f_batch_ptr fetch_batch_soa(const std::string &);
+
+    // Batch functions taking the number of evaluations n as last
+    // argument. The input array contains n * nvars values, in AoS or
+    // (for the SoA version) in variable-major layout.
+    using f_batch_n_ptr = void (*)(double *, const double *, std::uint64_t);
+    f_batch_n_ptr fetch_batch_n(const std::string &);
+    f_batch_n_ptr fetch_batch_soa_n(const std::string &);
+
+    // Batch functions reading the input in place (available if strided
+    // batches were enabled when the expression was added). The arguments
+    // are the output pointer and stride, the input and the number of
+    // evaluations n. The strides are in units of doubles: the output of the
+    // i-th evaluation is written at out[i * out_stride].
+    // In fetch_batch_strided(), the input is a single array with the values
+    // of the variables for the i-th evaluation at in[i * in_stride + j] (e.g.,
+    // the rows of an array of structs). In fetch_batch_cols(), the input is an
+    // array of pointers to the columns of the variables, with the value of the
+    // j-th variable for the i-th evaluation at cols[j][i * strides[j]] (e.g.,
+    // the columns of a dataframe).
+    using f_batch_strided_ptr = void (*)(double *, std::uint64_t, const double *, std::uint64_t, std::uint64_t);
+    f_batch_strided_ptr fetch_batch_strided(const std::string &);
+    using f_batch_cols_ptr
+        = void (*)(double *, std::uint64_t, const double *const *, const std::uint64_t *, std::uint64_t);
+    f_batch_cols_ptr fetch_batch_cols(const std::string &);
+
+    // Loss kernels (available if loss kernels were enabled when the
+    // expression was added). The arguments are the input array (in AoS
+    // layout, as in fetch_batch_n()), the array of the target values and
+    // the number of points n. The error for the i-th point is the value of
+    // the expression minus the i-th target value. The loss is zero if
+    // n is zero. NaN errors are propagated to the loss.
+    // NOTE: the accumulation of the errors is split among multiple partial
+    // sums, thus the results may differ slightly from a sequential loop.
+    using f_loss_ptr = double (*)(const double *, const double *, std::uint64_t);
+    f_loss_ptr fetch_loss(const std::string &, loss_type);
+
+    // Fused kernel added via add_expressions(): the first
+    // argument is the output array, the second one the input array.
+    using f_multi_ptr = void (*)(double *, const double *);
+    f_multi_ptr fetch_multi(const std::string &);
+
+    // Single-precision versions of the fetch functions.
+    using f_ptr_float = float (*)(const float *);
+    f_ptr_float fetch_float(const std::string &);
+    using f_batch_ptr_float = void (*)(float *, const float *);
+    f_batch_ptr_float fetch_batch_float(const std::string &);
+    f_batch_ptr_float fetch_batch_soa_float(const std::string &);
+    using f_batch_n_ptr_float = void (*)(float *, const float *, std::uint64_t);
+    f_batch_n_ptr_float fetch_batch_n_float(const std::string &);
+    f_batch_n_ptr_float fetch_batch_soa_n_float(const std::string &);
+    using f_batch_strided_ptr_float = void (*)(float *, std::uint64_t, const float *, std::uint64_t, std::uint64_t);
+    f_batch_strided_ptr_float fetch_batch_strided_float(const std::string &);
+    using f_batch_cols_ptr_float
+        = void (*)(float *, std::uint64_t, const float *const *, const std::uint64_t *, std::uint64_t);
+    f_batch_cols_ptr_float fetch_batch_cols_float(const std::string &);
+    using f_loss_ptr_float = float (*)(const float *, const float *, std::uint64_t);
+    f_loss_ptr_float fetch_loss_float(const std::string &, loss_type);
+    using f_multi_ptr_float = void (*)(float *, const float *);
+    f_multi_ptr_float fetch_multi_float(const std::string &);
+
+    // Versions of the fetch functions for the expressions containing
+    // parameters: the last argument is the array of the parameter values,
+    // whose size must be at least expression::get_n_params().
+    using f_par_ptr = double (*)(const double *, const double *);
+    f_par_ptr fetch_par(const std::string &);
+    using f_batch_par_ptr = void (*)(double *, const double *, const double *);
+    f_batch_par_ptr fetch_batch_par(const std::string &);
+    f_batch_par_ptr fetch_batch_soa_par(const std::string &);
+    using f_batch_n_par_ptr = void (*)(double *, const double *, std::uint64_t, const double *);
+    f_batch_n_par_ptr fetch_batch_n_par(const std::string &);
+    f_batch_n_par_ptr fetch_batch_soa_n_par(const std::string &);
+    using f_batch_strided_par_ptr
+        = void (*)(double *, std::uint64_t, const double *, std::uint64_t, std::uint64_t, const double *);
+    f_batch_strided_par_ptr fetch_batch_strided_par(const std::string &);
+    using f_batch_cols_par_ptr = void (*)(double *, std::uint64_t, const double *const *, const std::uint64_t *,
+                                          std::uint64_t, const double *);
+    f_batch_cols_par_ptr fetch_batch_cols_par(const std::string &);
+    using f_loss_par_ptr = double (*)(const double *, const double *, std::uint64_t, const double *);
+    f_loss_par_ptr fetch_loss_par(const std::string &, loss_type);
+
+    // Evaluate in parallel the expression name on the n points in the
+    // AoS input array in (as in fetch_batch_n()), writing the results
+    // into out. The points are split into chunks, which are distributed
+    // among the threads of a work-stealing pool. The chunk size is
+    // get_eval_chunk_size() or, if that is 0 (the default), it is chosen
+    // so that the input and the output of a chunk fit in the L2 cache.
+    // The number of threads is get_eval_threads() (by default, the number
+    // of hardware threads), including the calling thread. The pool is
+    // created on the first invocation and it is reused afterwards.
+    // NOTE: name must have been added via add_expression() to this
+    // state (not to a sibling), and it must not contain parameters.
+    void eval_batch_parallel(const std::string &, double *, const double *, std::uint64_t);
+    unsigned get_eval_threads() const;
+    void set_eval_threads(unsigned);
+    std::uint64_t get_eval_chunk_size() const;
+    void set_eval_chunk_size(std::uint64_t);
 
     expression to_expression(const std::string &) const;
 
+    // NOTE: if the system contains parameters, the integrator takes
+    // the array of the parameter values as last argument (see
+    // fetch_taylor_par()).
     void add_taylor(const std::string &, std::vector<expression>, unsigned = 20);
 
     void verify_function(llvm::Function *);
@@ -114,6 +538,11 @@ public:
     {
         return reinterpret_cast<f_taylor_ptr>(jit_lookup(name));
     }
+    using f_taylor_par_ptr = void (*)(double *, double, std::uint32_t, const double *);
+    f_taylor_par_ptr fetch_taylor_par(const std::string &name)
+    {
+        return reinterpret_cast<f_taylor_par_ptr>(jit_lookup(name));
+    }
 };
 
 } // namespace lambdifier
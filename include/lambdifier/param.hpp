@@ -0,0 +1,75 @@
+#ifndef LAMBDIFIER_PARAM_HPP
+#define LAMBDIFIER_PARAM_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Value.h>
+
+#include <lambdifier/detail/visibility.hpp>
+#include <lambdifier/expression.hpp>
+#include <lambdifier/llvm_state.hpp>
+
+namespace lambdifier
+{
+
+// A runtime parameter: the value of the parameter is not known when the
+// code is generated, and it is read from the index-th element of the array
+// of the parameter values passed as last argument to the compiled
+// functions (see, e.g., llvm_state::fetch_par()). Thus, the values of the
+// parameters can be changed without recompiling the functions.
+// NOTE: in the evaluation via the dictionaries of values (and in the
+// symbolic differentiation), a parameter behaves like a variable named
+// after its string representation (e.g., "par[0]").
+class LAMBDIFIER_DLL_PUBLIC param
+{
+    std::uint32_t index;
+
+public:
+    explicit param(std::uint32_t);
+    param(const param &);
+    param(param &&) noexcept;
+    ~param();
+
+    std::uint32_t get_index() const;
+    void set_index(std::uint32_t);
+
+    llvm::Value *codegen(llvm_state &) const;
+    std::string to_string() const;
+    double evaluate(std::unordered_map<std::string, double> &) const;
+    void evaluate(std::unordered_map<std::string, std::vector<double>> &, std::vector<double> &) const;
+    void compute_connections(std::vector<std::vector<unsigned>> &, unsigned &) const;
+    void compute_node_values(std::unordered_map<std::string, double> &in, std::vector<double> &node_values,
+                             const std::vector<std::vector<unsigned>> &node_connections, unsigned &node_counter) const
+    {
+        node_values[node_counter] = in[to_string()];
+        node_counter++;
+    }
+    void gradient(std::unordered_map<std::string, double> &in, std::unordered_map<std::string, double> &grad,
+                  const std::vector<double> &node_values, const std::vector<std::vector<unsigned>> &node_connections,
+                  unsigned &node_counter, double acc)
+    {
+        grad[to_string()] = grad[to_string()] + acc;
+        node_counter++;
+    }
+
+    expression diff(const std::string &) const;
+
+    llvm::Value *taylor_init(llvm_state &, llvm::Value *) const;
+    llvm::Function *taylor_diff(llvm_state &, const std::string &, std::uint32_t,
+                                const std::unordered_map<std::uint32_t, number> &) const;
+};
+
+inline namespace literals
+{
+
+LAMBDIFIER_DLL_PUBLIC expression operator""_par(unsigned long long);
+
+}
+
+} // namespace lambdifier
+
+#endif
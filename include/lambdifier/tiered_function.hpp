@@ -0,0 +1,95 @@
+#ifndef LAMBDIFIER_TIERED_FUNCTION_HPP
+#define LAMBDIFIER_TIERED_FUNCTION_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <lambdifier/detail/visibility.hpp>
+#include <lambdifier/expression.hpp>
+#include <lambdifier/function_call.hpp>
+#include <lambdifier/llvm_state.hpp>
+
+namespace lambdifier
+{
+
+namespace detail
+{
+
+// Instruction of the tape used by the interpreter
+// of a tiered function.
+struct tape_instr {
+    enum class kind : std::uint8_t { num, var, add, sub, mul, div, call1, call2, calln };
+
+    explicit tape_instr(kind k_) : k(k_) {}
+
+    kind k;
+    // Index of the variable (var), or
+    // number of arguments (calln).
+    std::uint32_t idx = 0;
+    // The value of the number (num).
+    double value = 0;
+    // The function to be invoked (call1, call2, calln).
+    double (*f1)(double) = nullptr;
+    double (*f2)(double, double) = nullptr;
+    function_call::eval_num_t fn;
+};
+
+} // namespace detail
+
+// A function which evaluates an expression via an interpreter
+// until the number of invocations reaches a threshold. At that point,
+// the expression is compiled in a background thread, and, once the compilation
+// is completed, the subsequent invocations will use the compiled code.
+// The arguments are passed as in llvm_state::fetch(), that is, in the
+// alphabetical order of the variables' names (see get_variables()).
+// NOTE: the expression is compiled using a sibling of the state passed on
+// construction, which must outlive the tiered function. The invocation
+// operator can be called concurrently from multiple threads.
+class LAMBDIFIER_DLL_PUBLIC tiered_function
+{
+    expression ex;
+    std::vector<std::string> vars;
+    std::vector<detail::tape_instr> tape;
+    // Max size of the stack needed to evaluate the tape.
+    std::uint32_t max_stack = 0;
+    const llvm_state &parent;
+    std::string name;
+    unsigned long long threshold;
+    std::atomic<unsigned long long> n_calls = 0;
+    std::atomic<llvm_state::f_ptr> jit_ptr = nullptr;
+    std::unique_ptr<llvm_state> state;
+    std::thread compiler;
+    std::exception_ptr compile_error;
+
+    LAMBDIFIER_DLL_LOCAL double interpret(const double *) const;
+    LAMBDIFIER_DLL_LOCAL void compile();
+
+public:
+    explicit tiered_function(expression, const llvm_state &, unsigned long long = 1000);
+
+    tiered_function(const tiered_function &) = delete;
+    tiered_function(tiered_function &&) = delete;
+    tiered_function &operator=(const tiered_function &) = delete;
+    tiered_function &operator=(tiered_function &&) = delete;
+
+    ~tiered_function();
+
+    double operator()(const double *);
+
+    const std::vector<std::string> &get_variables() const;
+    unsigned long long get_threshold() const;
+    bool is_compiled() const;
+
+    // Wait for the completion of the background compilation (if started),
+    // re-throwing any exception raised during the compilation.
+    void wait();
+};
+
+} // namespace lambdifier
+
+#endif
@@ -1,22 +1,39 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <mutex>
+#include <stdexcept>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <llvm/Config/llvm-config.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
 #include <llvm/ExecutionEngine/JITSymbol.h>
+#include <llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h>
 #include <llvm/ExecutionEngine/Orc/CompileUtils.h>
 #include <llvm/ExecutionEngine/Orc/Core.h>
 #include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
 #include <llvm/ExecutionEngine/Orc/IRCompileLayer.h>
+#include <llvm/ExecutionEngine/Orc/IndirectionUtils.h>
 #include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LazyReexports.h>
 #include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/ExecutionEngine/RuntimeDyld.h>
 #include <llvm/ExecutionEngine/SectionMemoryManager.h>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Object/ObjectFile.h>
 #include <llvm/Support/Error.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/Utils/SplitModule.h>
 
 #include <lambdifier/detail/jit.hpp>
 
@@ -30,11 +47,159 @@ namespace
 
 std::once_flag nt_inited;
 
+// The time spent by the current thread in the
+// generation of the last object file.
+// NOTE: the object layer loads an object in the same
+// thread in which the object was generated, right after
+// its generation. Thus, the memory manager of the object can
+// retrieve the codegen time from this variable.
+thread_local std::chrono::nanoseconds last_codegen_time{};
+
+#if LLVM_VERSION_MAJOR == 10
+
+// Compiler wrapper recording the codegen time.
+class timed_compiler final : public llvm::orc::IRCompileLayer::IRCompiler
+{
+    std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler> comp;
+
+public:
+    explicit timed_compiler(std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler> c)
+        : llvm::orc::IRCompileLayer::IRCompiler(c->getManglingOptions()), comp(std::move(c))
+    {
+    }
+
+    llvm::Expected<CompileResult> operator()(llvm::Module &m) override
+    {
+        const auto start = std::chrono::steady_clock::now();
+        auto retval = (*comp)(m);
+        last_codegen_time = std::chrono::steady_clock::now() - start;
+
+        return retval;
+    }
+};
+
+#endif
+
 } // namespace
 
+// A memory manager which forwards to a SectionMemoryManager,
+// and which can free the memory it allocated via release().
+// NOTE: the lifetime of the memory managers is tied to the
+// lifetime of the object layer, thus we cannot simply destroy
+// them in order to free the memory.
+class jit::memory_manager final : public llvm::RuntimeDyld::MemoryManager
+{
+    std::unique_ptr<llvm::SectionMemoryManager> mm;
+    // NOTE: a memory manager is created by the object layer
+    // right before the object is loaded.
+    const std::chrono::steady_clock::time_point start;
+
+public:
+    // The time spent generating and linking the object.
+    const std::chrono::nanoseconds codegen_time;
+    std::chrono::nanoseconds link_time{};
+    // The key of the object, and the event listeners
+    // which were notified of its loading.
+    llvm::JITEventListener::ObjectKey obj_key = 0;
+    std::vector<llvm::JITEventListener *> listeners;
+
+    // The object most recently loaded by the current thread, and its
+    // memory manager.
+    // NOTE: the object layer notifies the loading of an object in the
+    // same thread in which (and right after) the memory manager of the
+    // object is notified. Unlike a map indexed by object, this leaves no
+    // stale entries behind if the linking fails in between.
+    static thread_local std::pair<const llvm::object::ObjectFile *, memory_manager *> last_loaded;
+
+    memory_manager()
+        : mm(std::make_unique<llvm::SectionMemoryManager>()), start(std::chrono::steady_clock::now()),
+          codegen_time(std::exchange(last_codegen_time, std::chrono::nanoseconds{}))
+    {
+    }
+
+    std::uint8_t *allocateCodeSection(std::uintptr_t size, unsigned alignment, unsigned id,
+                                      llvm::StringRef name) override
+    {
+        assert(mm);
+        return mm->allocateCodeSection(size, alignment, id, name);
+    }
+    std::uint8_t *allocateDataSection(std::uintptr_t size, unsigned alignment, unsigned id, llvm::StringRef name,
+                                      bool read_only) override
+    {
+        assert(mm);
+        return mm->allocateDataSection(size, alignment, id, name, read_only);
+    }
+    bool needsToReserveAllocationSpace() override
+    {
+        assert(mm);
+        return mm->needsToReserveAllocationSpace();
+    }
+    void reserveAllocationSpace(std::uintptr_t code_size, std::uint32_t code_align, std::uintptr_t ro_data_size,
+                                std::uint32_t ro_data_align, std::uintptr_t rw_data_size,
+                                std::uint32_t rw_data_align) override
+    {
+        assert(mm);
+        mm->reserveAllocationSpace(code_size, code_align, ro_data_size, ro_data_align, rw_data_size, rw_data_align);
+    }
+    void registerEHFrames(std::uint8_t *addr, std::uint64_t load_addr, std::size_t size) override
+    {
+        assert(mm);
+        mm->registerEHFrames(addr, load_addr, size);
+    }
+    void deregisterEHFrames() override
+    {
+        if (mm) {
+            mm->deregisterEHFrames();
+        }
+    }
+    bool finalizeMemory(std::string *err_msg) override
+    {
+        assert(mm);
+        const auto retval = mm->finalizeMemory(err_msg);
+        // NOTE: the finalisation of the memory is
+        // the last step of the linking process.
+        link_time = std::chrono::steady_clock::now() - start;
+
+        return retval;
+    }
+    void notifyObjectLoaded(llvm::RuntimeDyld &, const llvm::object::ObjectFile &obj) override
+    {
+        // Record the association between the object and this
+        // memory manager. The association will be used
+        // when the object layer notifies the loading
+        // of the object.
+        last_loaded = {&obj, this};
+    }
+
+    // Notify the event listeners that the
+    // memory of the object is about to be freed.
+    void notify_freeing()
+    {
+        for (auto *l : listeners) {
+            l->notifyFreeingObject(obj_key);
+        }
+        listeners.clear();
+    }
+
+    // Free the memory.
+    // NOTE: the object layer keeps the memory manager alive,
+    // thus we free all the resources it holds.
+    void release()
+    {
+        notify_freeing();
+        listeners.shrink_to_fit();
+
+        if (mm) {
+            mm->deregisterEHFrames();
+            mm.reset();
+        }
+    }
+};
+
+thread_local std::pair<const llvm::object::ObjectFile *, jit::memory_manager *> jit::memory_manager::last_loaded{};
+
 jit::jit()
-    : object_layer(es, []() { return std::make_unique<llvm::SectionMemoryManager>(); }),
-      ctx(std::make_unique<llvm::LLVMContext>())
+    : object_layer(es, []() { return std::make_unique<memory_manager>(); })
 #if LLVM_VERSION_MAJOR == 10
       ,
       main_jd(es.createJITDylib("<main>"))
@@ -46,25 +211,95 @@ jit::jit()
         llvm::InitializeNativeTargetAsmParser();
     });
 
+    // Assign the memory managers of the loaded objects to the
+    // corresponding units, and notify the event listeners.
+    object_layer.setNotifyLoaded([this](llvm::orc::VModuleKey k, const llvm::object::ObjectFile &obj,
+                                        const llvm::RuntimeDyld::LoadedObjectInfo &info) {
+        const auto [l_obj, mm] = std::exchange(memory_manager::last_loaded, {});
+
+        std::lock_guard lock{mms_mutex};
+
+        if (l_obj == &obj) {
+            unit_mms[k].push_back(mm);
+
+            mm->obj_key = next_obj_key++;
+            for (auto *l : {gdb_listener, perf_listener}) {
+                if (l != nullptr) {
+                    l->notifyObjectLoaded(mm->obj_key, obj, info);
+                    mm->listeners.push_back(l);
+                }
+            }
+        }
+    });
+
     auto jtmb = llvm::orc::JITTargetMachineBuilder::detectHost();
 
     if (!jtmb) {
         throw std::invalid_argument("Error invoking llvm::orc::JITTargetMachineBuilder::detectHost()");
     }
 
+    // NOTE: detectHost() sets up the features of the host CPU,
+    // but not its name, which is used for tuning.
+    jtmb->setCPU(llvm::sys::getHostCPUName().str());
+
     auto dlout = jtmb->getDefaultDataLayoutForTarget();
     if (!dlout) {
         throw std::invalid_argument("Error invoking getDefaultDataLayoutForTarget()");
     }
 
+    // Keep a copy of the target machine builder, which
+    // we will use to create target machines on demand.
+    jtmb_copy = std::make_unique<llvm::orc::JITTargetMachineBuilder>(*jtmb);
+
+    // Setup the identifier of the target in the object cache.
+    auto tm = create_target_machine();
+    obj_cache.set_target_id(tm->getTargetTriple().str() + "|" + tm->getTargetCPU().str() + "|"
+                            + tm->getTargetFeatureString().str() + "|"
+                            + std::to_string(static_cast<int>(tm->getOptLevel())));
+
 #if LLVM_VERSION_MAJOR == 10
     compile_layer = std::make_unique<llvm::orc::IRCompileLayer>(
-        es, object_layer, std::make_unique<llvm::orc::ConcurrentIRCompiler>(std::move(*jtmb)));
+        es, object_layer,
+        std::make_unique<timed_compiler>(
+            std::make_unique<llvm::orc::ConcurrentIRCompiler>(std::move(*jtmb), &obj_cache)));
 #else
-    compile_layer = std::make_unique<llvm::orc::IRCompileLayer>(es, object_layer,
-                                                                llvm::orc::ConcurrentIRCompiler(std::move(*jtmb)));
+    // NOTE: in LLVM 9, ConcurrentIRCompiler does not support object
+    // caches, thus we replicate its logic here.
+    compile_layer = std::make_unique<llvm::orc::IRCompileLayer>(
+        es, object_layer,
+        [jtmb = std::move(*jtmb), cache = &obj_cache](llvm::Module &m)
+            -> llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> {
+            // NOTE: createTargetMachine() is not const, thus
+            // we operate on a copy of the builder in order
+            // to allow for concurrent compilation.
+            const auto start = std::chrono::steady_clock::now();
+            auto c_tm = llvm::orc::JITTargetMachineBuilder(jtmb).createTargetMachine();
+            if (!c_tm) {
+                return c_tm.takeError();
+            }
+            auto retval = llvm::orc::SimpleCompiler(**c_tm, cache)(m);
+            last_codegen_time = std::chrono::steady_clock::now() - start;
+
+            return retval;
+        });
 #endif
 
+    // Setup the compile-on-demand layer, which is used in lazy mode.
+    // NOTE: the compile-on-demand layer replaces the functions in a module
+    // with stubs, and it compiles the body of a function (via the compile
+    // layer) only when the corresponding stub is invoked for the first time.
+    auto lctm_out = llvm::orc::createLocalLazyCallThroughManager(jtmb_copy->getTargetTriple(), es, 0);
+    if (!lctm_out) {
+        throw std::invalid_argument("Error creating the lazy call-through manager. The full error message:\n"
+                                    + llvm::toString(lctm_out.takeError()));
+    }
+    lctm = std::move(*lctm_out);
+    cod_layer = std::make_unique<llvm::orc::CompileOnDemandLayer>(
+        es, *compile_layer, *lctm, llvm::orc::createLocalIndirectStubsManagerBuilder(jtmb_copy->getTargetTriple()));
+    // NOTE: compile only the requested functions (plus
+    // whatever they depend on), rather than whole modules.
+    cod_layer->setPartitionFunction(llvm::orc::CompileOnDemandLayer::compileRequested);
+
     dl = std::make_unique<llvm::DataLayout>(std::move(*dlout));
 
     mangle = std::make_unique<llvm::orc::MangleAndInterner>(es, *dl);
@@ -78,11 +313,15 @@ jit::jit()
 #endif
 }
 
-jit::~jit() = default;
-
-llvm::LLVMContext &jit::get_context()
+jit::~jit()
 {
-    return *ctx.getContext();
+    // NOTE: the memory of the objects will be
+    // freed by the destruction of the object layer.
+    for (auto &p : unit_mms) {
+        for (auto *mm : p.second) {
+            mm->notify_freeing();
+        }
+    }
 }
 
 const llvm::DataLayout &jit::get_data_layout() const
@@ -90,17 +329,443 @@ const llvm::DataLayout &jit::get_data_layout() const
     return *dl;
 }
 
-void jit::add_module(std::unique_ptr<llvm::Module> &&m)
+std::string jit::get_target_triple() const
+{
+    return jtmb_copy->getTargetTriple().str();
+}
+
+std::unique_ptr<llvm::TargetMachine> jit::create_target_machine(bool pic) const
+{
+    auto builder = *jtmb_copy;
+    if (pic) {
+        builder.setRelocationModel(llvm::Reloc::PIC_);
+    }
+
+    auto tm = builder.createTargetMachine();
+    if (!tm) {
+        throw std::invalid_argument("Error creating a target machine. The full error message:\n"
+                                    + llvm::toString(tm.takeError()));
+    }
+
+    return std::move(*tm);
+}
+
+// Add the module m to the JIT, splitting it into n_parts partitions which
+// are compiled concurrently. The aliases (pairs of alias and target names,
+// with the targets defined in m) are defined together with the module, and
+// they become part of the unit.
+jit::unit_id jit::add_module(llvm::orc::ThreadSafeContext ctx, std::unique_ptr<llvm::Module> &&m, unsigned n_parts,
+                             const std::vector<std::pair<std::string, std::string>> &aliases)
+{
+    // Collect the names of the symbols defined in the module
+    // which will be visible from outside the module.
+    std::vector<std::string> new_names;
+    for (const auto &gv : m->global_values()) {
+        if (!gv.isDeclaration() && !gv.hasLocalLinkage()) {
+            new_names.emplace_back(gv.getName());
+        }
+    }
+
+    // NOTE: in lazy mode, the partitioning of the module
+    // is taken care of by the compile-on-demand layer.
+    const bool is_lazy = lazy;
+    if (is_lazy) {
+        n_parts = 1;
+    }
+
+    const auto k = es.allocateVModule();
+
+    // Split the module into partitions, if requested.
+    // NOTE: SplitModule() will externalise the symbols with
+    // local linkage (as hidden symbols), so that they can
+    // be referenced across partitions.
+    std::vector<std::unique_ptr<llvm::Module>> parts;
+    if (n_parts > 1u) {
+        // NOTE: the externalised symbols keep their names, thus
+        // two modules defining the same local symbol (e.g., the same
+        // vector math function) would clash in the JIT. Make their
+        // names unique to the unit before splitting (in the same spirit
+        // as the promotion of the locals in the compile-on-demand layer).
+        // The suffix is derived from the IR of the module (rather than
+        // from the unit), so that the partitions of identical modules are
+        // identical across runs and they can be found in the object cache.
+        // NOTE: the modules with the same IR define the same visible
+        // symbols, thus they cannot coexist in the JIT.
+        const auto suffix = ".lcl" + ir_hash(*m).substr(0, 16);
+        for (auto &gv : m->global_values()) {
+            if (!gv.isDeclaration() && gv.hasLocalLinkage()) {
+                gv.setName((gv.hasName() ? gv.getName().str() : std::string("__lambdifier_unnamed")) + suffix);
+            }
+        }
+
+        llvm::SplitModule(
+            std::move(m), n_parts, [&parts](std::unique_ptr<llvm::Module> part) { parts.push_back(std::move(part)); },
+            false);
+    } else {
+        parts.push_back(std::move(m));
+    }
+
+    // For each partition, pick the name of a visible symbol.
+    // Looking it up will trigger the compilation of
+    // the whole partition. At the same time, collect the names
+    // of all the symbols that the unit will define in the JIT
+    // (including the externalised ones).
+    std::vector<std::string> part_syms;
+    std::vector<std::vector<std::string>> part_names;
+    unit u;
+    u.lazy = is_lazy;
+    for (const auto &part : parts) {
+        bool found = false;
+        part_names.emplace_back();
+        for (const auto &gv : part->global_values()) {
+            if (!gv.isDeclaration() && !gv.hasLocalLinkage()) {
+                u.names.emplace_back(gv.getName());
+                part_names.back().emplace_back(gv.getName());
+                if (!found && !gv.hasHiddenVisibility()) {
+                    part_syms.emplace_back(gv.getName());
+                    found = true;
+                }
+            }
+        }
+    }
+
+    u.part_syms = part_syms;
+
+    {
+        std::lock_guard lock{sym_names_mutex};
+
+        for (const auto &name : new_names) {
+            if (sym_names.find(name) != sym_names.end()) {
+                throw std::invalid_argument("Cannot add a module to the JIT: the symbol '" + name
+                                            + "' has already been defined in another module");
+            }
+        }
+        for (const auto &[alias, target] : aliases) {
+            if (sym_names.find(alias) != sym_names.end()) {
+                throw std::invalid_argument("Cannot add a module to the JIT: the alias '" + alias
+                                            + "' has already been defined in another module");
+            }
+            if (std::find(new_names.begin(), new_names.end(), target) == new_names.end()) {
+                throw std::invalid_argument("Cannot add a module to the JIT: the target '" + target
+                                            + "' of the alias '" + alias + "' is not defined in the module");
+            }
+        }
+
+        // Remove from the JIT the first n partitions.
+        auto remove_parts = [&](decltype(parts.size()) n) {
+            llvm::orc::SymbolNameSet to_remove;
+            for (decltype(n) j = 0; j < n; ++j) {
+                for (const auto &name : part_names[j]) {
+                    to_remove.insert((*mangle)(name));
+                }
+            }
+            if (!to_remove.empty()) {
+#if LLVM_VERSION_MAJOR == 10
+                llvm::consumeError(main_jd.remove(to_remove));
+#else
+                llvm::consumeError(es.getMainJITDylib().remove(to_remove));
+#endif
+            }
+        };
+
+        for (decltype(parts.size()) i = 0; i < parts.size(); ++i) {
+            llvm::orc::ThreadSafeModule tsm(std::move(parts[i]), ctx);
+            if (n_parts > 1u) {
+                // NOTE: the partitions need to live in separate contexts
+                // in order to be compiled concurrently.
+                tsm = llvm::orc::cloneToNewContext(tsm);
+            }
+
+            auto &layer = is_lazy ? static_cast<llvm::orc::IRLayer &>(*cod_layer) : *compile_layer;
+#if LLVM_VERSION_MAJOR == 10
+            auto err = layer.add(main_jd, std::move(tsm), k);
+#else
+            auto err = layer.add(es.getMainJITDylib(), std::move(tsm), k);
+#endif
+
+            if (err) {
+                // Remove from the JIT the partitions
+                // which have already been added.
+                remove_parts(i);
+
+                throw std::invalid_argument("Could not add a module to the JIT. The full error message:\n"
+                                            + llvm::toString(std::move(err)));
+            }
+        }
+
+        // Define the aliases.
+        if (!aliases.empty()) {
+            llvm::orc::SymbolAliasMap alias_map;
+            for (const auto &[alias, target] : aliases) {
+                alias_map.try_emplace((*mangle)(alias), (*mangle)(target),
+                                      llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable);
+                u.names.push_back(alias);
+            }
+#if LLVM_VERSION_MAJOR == 10
+            auto err = main_jd.define(llvm::orc::symbolAliases(std::move(alias_map)));
+#else
+            auto err = es.getMainJITDylib().define(llvm::orc::symbolAliases(std::move(alias_map)));
+#endif
+            if (err) {
+                remove_parts(parts.size());
+
+                throw std::invalid_argument("Could not define the module aliases in the JIT. The full error message:\n"
+                                            + llvm::toString(std::move(err)));
+            }
+        }
+
+        sym_names.insert(new_names.begin(), new_names.end());
+        for (const auto &p : aliases) {
+            sym_names.insert(p.first);
+        }
+        units.emplace(k, std::move(u));
+    }
+
+    if (n_parts > 1u) {
+        // Compile the partitions concurrently.
+        // NOTE: the materialisation of each partition happens
+        // in the thread which looks up one of its symbols.
+        std::vector<std::string> errors(part_syms.size());
+        {
+            llvm::ThreadPool pool(n_parts);
+            for (decltype(part_syms.size()) i = 0; i < part_syms.size(); ++i) {
+                pool.async([this, &part_syms, &errors, i]() {
+                    if (auto sym = lookup(part_syms[i]); !sym) {
+                        errors[i] = llvm::toString(sym.takeError());
+                    }
+                });
+            }
+            pool.wait();
+        }
+
+        for (const auto &err : errors) {
+            if (!err.empty()) {
+                // NOTE: the caller will not receive the id of the
+                // unit, thus we remove the unit from the JIT.
+                try {
+                    release(k);
+                } catch (...) {
+                }
+
+                throw std::runtime_error("Error compiling a module partition. The full error message:\n" + err);
+            }
+        }
+    }
+
+    return k;
+}
+
+void jit::release(unit_id k)
 {
+    {
+        std::lock_guard lock{sym_names_mutex};
+
+        const auto it = units.find(k);
+        if (it == units.end()) {
+            throw std::invalid_argument("Cannot release the unit of compiled code with id " + std::to_string(k)
+                                        + ": the unit does not exist");
+        }
+
+        if (it->second.lazy) {
+            throw std::invalid_argument("Cannot release the unit of compiled code with id " + std::to_string(k)
+                                        + ": units compiled in lazy mode cannot be released");
+        }
+
+        // Remove the symbols from the JIT.
+        // NOTE: this will also discard the
+        // code which has not been compiled yet.
+        llvm::orc::SymbolNameSet to_remove;
+        for (const auto &name : it->second.names) {
+            to_remove.insert((*mangle)(name));
+        }
 #if LLVM_VERSION_MAJOR == 10
-    auto handle = compile_layer->add(main_jd, llvm::orc::ThreadSafeModule(std::move(m), ctx));
+        auto err = main_jd.remove(to_remove);
 #else
-    auto handle = compile_layer->add(es.getMainJITDylib(), llvm::orc::ThreadSafeModule(std::move(m), ctx));
+        auto err = es.getMainJITDylib().remove(to_remove);
 #endif
+        if (err) {
+            throw std::invalid_argument("Cannot release the unit of compiled code with id " + std::to_string(k)
+                                        + ". The full error message:\n" + llvm::toString(std::move(err)));
+        }
+
+        for (const auto &name : it->second.names) {
+            sym_names.erase(name);
+        }
+        units.erase(it);
+    }
+
+    // Free the code and data of the unit.
+    std::vector<memory_manager *> mms;
+    {
+        std::lock_guard lock{mms_mutex};
+
+        if (const auto it = unit_mms.find(k); it != unit_mms.end()) {
+            mms = std::move(it->second);
+            unit_mms.erase(it);
+        }
+    }
+    for (auto *mm : mms) {
+        mm->release();
+    }
+}
+
+std::string jit::get_object_cache_dir() const
+{
+    return obj_cache.get_dir();
+}
+
+void jit::set_object_cache_dir(std::string dir)
+{
+    obj_cache.set_dir(std::move(dir));
+}
+
+// Trigger the generation of the machine code for the unit k.
+// NOTE: this is a no-op for the partitions which
+// have already been materialised.
+void jit::materialize(unit_id k)
+{
+    std::vector<std::string> part_syms;
+    {
+        std::lock_guard lock{sym_names_mutex};
+
+        const auto it = units.find(k);
+        if (it == units.end()) {
+            throw std::invalid_argument("Cannot materialize the unit of compiled code with id " + std::to_string(k)
+                                        + ": the unit does not exist");
+        }
+        part_syms = it->second.part_syms;
+    }
+
+    for (const auto &name : part_syms) {
+        if (auto sym = lookup(name); !sym) {
+            throw std::runtime_error("Error materializing the unit of compiled code with id " + std::to_string(k)
+                                     + ". The full error message:\n" + llvm::toString(sym.takeError()));
+        }
+    }
+}
+
+jit::unit_timings jit::get_unit_timings(unit_id k)
+{
+    std::lock_guard lock{mms_mutex};
+
+    unit_timings retval;
+    if (const auto it = unit_mms.find(k); it != unit_mms.end()) {
+        for (const auto *mm : it->second) {
+            retval.codegen += mm->codegen_time;
+            retval.link += mm->link_time;
+        }
+    }
+
+    return retval;
+}
+
+bool jit::get_lazy() const
+{
+    return lazy;
+}
+
+void jit::set_lazy(bool f)
+{
+    lazy = f;
+}
+
+bool jit::get_gdb_support() const
+{
+    std::lock_guard lock{mms_mutex};
+
+    return gdb_listener != nullptr;
+}
+
+// Register the generated objects with the GDB JIT interface, so that
+// the JIT-compiled functions can be identified in the debugger.
+// NOTE: the setting applies to the objects loaded after the invocation
+// of this function.
+void jit::set_gdb_support(bool f)
+{
+    std::lock_guard lock{mms_mutex};
+
+    gdb_listener = f ? llvm::JITEventListener::createGDBRegistrationListener() : nullptr;
+    // NOTE: load also the sections which are not needed
+    // for execution (e.g., debug info).
+    object_layer.setProcessAllSections(f);
+}
+
+bool jit::get_perf_support() const
+{
+    std::lock_guard lock{mms_mutex};
+
+    return perf_listener != nullptr;
+}
+
+// Write the perf jitdump records for the generated objects, so
+// that the JIT-compiled functions can be identified in perf.
+// NOTE: the setting applies to the objects loaded after the invocation
+// of this function.
+void jit::set_perf_support(bool f)
+{
+    llvm::JITEventListener *l = nullptr;
+    if (f) {
+        l = llvm::JITEventListener::createPerfJITEventListener();
+        if (l == nullptr) {
+            throw std::invalid_argument("Cannot enable perf support: LLVM was built without perf support");
+        }
+    }
+
+    std::lock_guard lock{mms_mutex};
 
-    if (handle) {
-        throw;
+    perf_listener = l;
+}
+
+bool jit::has_unit(unit_id k) const
+{
+    std::lock_guard lock{sym_names_mutex};
+
+    return units.find(k) != units.end();
+}
+
+bool jit::has_symbol(const std::string &name) const
+{
+    std::lock_guard lock{sym_names_mutex};
+
+    return sym_names.find(name) != sym_names.end();
+}
+
+// Define the symbol alias as an alias of the symbol target,
+// which must have been added to the JIT already. The alias
+// becomes part of the unit of target, and thus it is
+// released together with target.
+void jit::add_alias(const std::string &alias, const std::string &target)
+{
+    std::lock_guard lock{sym_names_mutex};
+
+    if (sym_names.find(alias) != sym_names.end()) {
+        throw std::invalid_argument("Cannot add the alias '" + alias
+                                    + "' to the JIT: the symbol has already been defined");
+    }
+
+    const auto it = std::find_if(units.begin(), units.end(), [&target](const auto &p) {
+        return std::find(p.second.names.begin(), p.second.names.end(), target) != p.second.names.end();
+    });
+    if (it == units.end()) {
+        throw std::invalid_argument("Cannot add the alias '" + alias + "' to the JIT: the target symbol '" + target
+                                    + "' does not exist");
+    }
+
+    llvm::orc::SymbolAliasMap aliases;
+    aliases.try_emplace((*mangle)(alias), (*mangle)(target),
+                        llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable);
+#if LLVM_VERSION_MAJOR == 10
+    auto err = main_jd.define(llvm::orc::symbolAliases(std::move(aliases)));
+#else
+    auto err = es.getMainJITDylib().define(llvm::orc::symbolAliases(std::move(aliases)));
+#endif
+    if (err) {
+        throw std::invalid_argument("Cannot add the alias '" + alias + "' to the JIT. The full error message:\n"
+                                    + llvm::toString(std::move(err)));
     }
+
+    it->second.names.push_back(alias);
+    sym_names.insert(alias);
 }
 
 llvm::Expected<llvm::JITEvaluatedSymbol> jit::lookup(const std::string &name)
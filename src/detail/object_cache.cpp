@@ -0,0 +1,183 @@
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <lambdifier/detail/object_cache.hpp>
+
+namespace lambdifier::detail
+{
+
+namespace
+{
+
+// Print the IR of the module m.
+// NOTE: the module identifier and the source file name
+// are the name of the llvm_state which created the module,
+// thus they are not printed in order to make the result
+// independent of the name of the state.
+std::string print_ir(const llvm::Module &m)
+{
+    std::string ir;
+    llvm::raw_string_ostream ostr(ir);
+    m.print(ostr, nullptr);
+    ostr.flush();
+
+    std::string_view retval{ir};
+    for (const auto *prefix : {"; ModuleID = ", "source_filename = "}) {
+        if (retval.substr(0, std::char_traits<char>::length(prefix)) == prefix) {
+            const auto nl = retval.find('\n');
+            retval.remove_prefix(nl == std::string_view::npos ? retval.size() : nl + 1u);
+        }
+    }
+
+    return std::string(retval);
+}
+
+} // namespace
+
+std::string ir_hash(const llvm::Module &m)
+{
+    llvm::SHA1 hasher;
+    hasher.update(print_ir(m));
+
+    return llvm::toHex(hasher.final(), true);
+}
+
+object_cache::object_cache() = default;
+
+object_cache::~object_cache() = default;
+
+std::string object_cache::get_dir() const
+{
+    std::lock_guard lock{mutex};
+
+    return dir;
+}
+
+void object_cache::set_dir(std::string d)
+{
+    std::lock_guard lock{mutex};
+
+    dir = std::move(d);
+}
+
+void object_cache::set_target_id(std::string id)
+{
+    std::lock_guard lock{mutex};
+
+    target_id = std::move(id);
+}
+
+// NOTE: this must be called with the mutex locked.
+std::string object_cache::compute_key(const llvm::Module *m) const
+{
+    llvm::SHA1 hasher;
+    hasher.update(target_id);
+    hasher.update(print_ir(*m));
+
+    return llvm::toHex(hasher.final(), true);
+}
+
+std::unique_ptr<llvm::MemoryBuffer> object_cache::getObject(const llvm::Module *m)
+{
+    std::string path;
+
+    {
+        std::lock_guard lock{mutex};
+
+        if (dir.empty()) {
+            return nullptr;
+        }
+
+        // NOTE: record the key, so that we won't have to compute
+        // it again in notifyObjectCompiled() in case of a cache miss.
+        auto key = compute_key(m);
+        path = (std::filesystem::path(dir) / (key + ".o")).string();
+        keys[m] = std::move(key);
+    }
+
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+        // Cache miss.
+        return nullptr;
+    }
+    std::string obj{std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()};
+    if (!ifs.good() && !ifs.eof()) {
+        return nullptr;
+    }
+
+    {
+        // Cache hit: notifyObjectCompiled() will not be
+        // called for m, thus remove its key.
+        std::lock_guard lock{mutex};
+        keys.erase(m);
+    }
+
+    return llvm::MemoryBuffer::getMemBufferCopy(obj, m->getModuleIdentifier());
+}
+
+void object_cache::notifyObjectCompiled(const llvm::Module *m, llvm::MemoryBufferRef obj)
+{
+    std::string d, key;
+
+    {
+        std::lock_guard lock{mutex};
+
+        auto it = keys.find(m);
+        if (it == keys.end() || dir.empty()) {
+            return;
+        }
+        key = std::move(it->second);
+        keys.erase(it);
+        d = dir;
+    }
+
+    // NOTE: failures in writing to the cache are not errors,
+    // we just won't be able to re-use the object in the future.
+    std::error_code ec;
+    std::filesystem::create_directories(d, ec);
+    if (ec) {
+        return;
+    }
+
+    // NOTE: write first to a temporary file, and then rename
+    // it, so that other processes sharing the cache directory
+    // will never see a partially-written object.
+    const auto path = std::filesystem::path(d) / (key + ".o");
+    auto tmp_path = path;
+    tmp_path += ".tmp." + std::to_string(std::random_device{}());
+
+    {
+        std::ofstream ofs(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!ofs) {
+            return;
+        }
+        ofs.write(obj.getBufferStart(), static_cast<std::streamsize>(obj.getBufferSize()));
+        if (!ofs) {
+            std::filesystem::remove(tmp_path, ec);
+            return;
+        }
+    }
+
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        std::filesystem::remove(tmp_path, ec);
+    }
+}
+
+} // namespace lambdifier::detail
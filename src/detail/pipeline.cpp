@@ -0,0 +1,250 @@
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/Analysis/CGSCCPassManager.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalValue.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Transforms/Scalar/EarlyCSE.h>
+#include <llvm/Transforms/Scalar/GVN.h>
+#include <llvm/Transforms/Scalar/LICM.h>
+#include <llvm/Transforms/Scalar/LoopPassManager.h>
+#include <llvm/Transforms/Scalar/LoopRotation.h>
+#include <llvm/Transforms/Scalar/LoopUnrollPass.h>
+#include <llvm/Transforms/Scalar/Reassociate.h>
+#include <llvm/Transforms/Scalar/SROA.h>
+#include <llvm/Transforms/Scalar/SimplifyCFG.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/Mem2Reg.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+#include <llvm/Transforms/Vectorize/LoopVectorize.h>
+#include <llvm/Transforms/Vectorize/SLPVectorizer.h>
+
+#include <lambdifier/detail/pipeline.hpp>
+
+namespace lambdifier::detail
+{
+
+namespace
+{
+
+// The attribute marking the functions optimised by a fn_pipeline.
+constexpr char pipeline_attr[] = "lambdifier-pipeline";
+
+// Inline into f all the calls to the functions defined in the
+// module of f. The callees with internal linkage which are not
+// used any more are removed from the module.
+void inline_calls(llvm::Function &f)
+{
+    // NOTE: the inlining of a call may expose further calls
+    // (i.e., those in the body of the callee), thus we iterate
+    // until there are no more calls to inline.
+    while (true) {
+        std::vector<llvm::CallInst *> calls;
+        for (auto &bb : f) {
+            for (auto &inst : bb) {
+                if (auto *call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
+                    auto *callee = call->getCalledFunction();
+                    if (callee != nullptr && callee != &f && !callee->isDeclaration()) {
+                        calls.push_back(call);
+                    }
+                }
+            }
+        }
+
+        if (calls.empty()) {
+            break;
+        }
+
+        llvm::SmallPtrSet<llvm::Function *, 8> callees;
+        for (auto *call : calls) {
+            auto *callee = call->getCalledFunction();
+            callees.insert(callee);
+
+            llvm::InlineFunctionInfo ifi;
+#if LLVM_VERSION_MAJOR == 10
+            if (!llvm::InlineFunction(call, ifi).isSuccess()) {
+#else
+            if (!llvm::InlineFunction(call, ifi)) {
+#endif
+                throw std::runtime_error("Could not inline the function '" + callee->getName().str()
+                                         + "' into the function '" + f.getName().str() + "'");
+            }
+        }
+
+        for (auto *callee : callees) {
+            if (callee->hasLocalLinkage() && callee->use_empty()) {
+                callee->eraseFromParent();
+            }
+        }
+    }
+}
+
+// Add to fpm the passes of the preset name. Returns false
+// if name is not a preset.
+bool add_preset(llvm::PassBuilder &pb, llvm::FunctionPassManager &fpm, const std::string &name)
+{
+    using opt_level = llvm::PassBuilder::OptimizationLevel;
+
+    if (name == "O0") {
+        return true;
+    }
+
+    if (name == "cleanup") {
+        // Promote the allocas to registers and fold the
+        // trivially redundant instructions.
+        fpm.addPass(llvm::PromotePass());
+        fpm.addPass(llvm::InstCombinePass());
+        fpm.addPass(llvm::SimplifyCFGPass());
+
+        return true;
+    }
+
+    if (name == "O1" || name == "O2" || name == "O3") {
+        const auto l = name == "O1" ? opt_level::O1 : (name == "O2" ? opt_level::O2 : opt_level::O3);
+
+        fpm = pb.buildFunctionSimplificationPipeline(l, llvm::PassBuilder::ThinLTOPhase::None);
+        // NOTE: the vectorizers are part of the module-level
+        // pipeline in LLVM, add them explicitly.
+        if (name != "O1") {
+            fpm.addPass(llvm::LoopVectorizePass());
+            fpm.addPass(llvm::SLPVectorizerPass());
+            fpm.addPass(llvm::InstCombinePass());
+        }
+        if (name == "O3") {
+            fpm.addPass(llvm::LoopUnrollPass(llvm::LoopUnrollOptions(3)));
+        }
+
+        return true;
+    }
+
+    if (name == "taylor") {
+        // After inlining, the Taylor functions consist of long
+        // sequences of loads/stores from/to the derivatives array,
+        // interleaved with small loops over the derivative orders.
+        // We focus on the cleanup of the redundant memory operations
+        // and on the hoisting of the loop invariants, and we try to
+        // pack the independent scalar operations into vectors.
+        fpm.addPass(llvm::SROA());
+        fpm.addPass(llvm::EarlyCSEPass(true));
+        fpm.addPass(llvm::SimplifyCFGPass());
+        fpm.addPass(llvm::InstCombinePass());
+        fpm.addPass(llvm::ReassociatePass());
+        fpm.addPass(llvm::GVN());
+        llvm::LoopPassManager lpm;
+        lpm.addPass(llvm::LoopRotatePass());
+        lpm.addPass(llvm::LICMPass());
+        fpm.addPass(llvm::createFunctionToLoopPassAdaptor(std::move(lpm)));
+        fpm.addPass(llvm::LoopUnrollPass(llvm::LoopUnrollOptions(3)));
+        fpm.addPass(llvm::InstCombinePass());
+        fpm.addPass(llvm::SLPVectorizerPass());
+        fpm.addPass(llvm::SimplifyCFGPass());
+
+        return true;
+    }
+
+    return false;
+}
+
+} // namespace
+
+fn_pipeline::fn_pipeline(llvm::TargetMachine &tm, std::string n) : name(std::move(n))
+{
+    llvm::PassBuilder pb(&tm);
+
+    // Register the analyses (including the
+    // target-specific ones) and the proxies between
+    // the analysis managers.
+    pb.registerModuleAnalyses(mam);
+    pb.registerCGSCCAnalyses(cam);
+    pb.registerFunctionAnalyses(fam);
+    pb.registerLoopAnalyses(lam);
+    pb.crossRegisterProxies(lam, fam, cam, mam);
+
+    if (!add_preset(pb, fpm, name)) {
+        if (auto err = pb.parsePassPipeline(fpm, name)) {
+            throw std::invalid_argument("Invalid optimisation pipeline '" + name
+                                        + "': " + llvm::toString(std::move(err)));
+        }
+    }
+}
+
+fn_pipeline::~fn_pipeline() = default;
+
+const std::string &fn_pipeline::get_name() const
+{
+    return name;
+}
+
+void fn_pipeline::run(llvm::Function &f)
+{
+    inline_calls(f);
+
+    fpm.run(f, fam);
+    // NOTE: the functions may be modified or erased
+    // after this point, don't keep stale analyses around.
+    fam.clear();
+
+    f.addFnAttr(pipeline_attr, name);
+}
+
+bool has_fn_pipeline(const llvm::Function &f)
+{
+    return f.hasFnAttribute(pipeline_attr);
+}
+
+void run_module_pm(llvm::legacy::PassManager &pm, llvm::Module &m)
+{
+    bool skip = false;
+    for (const auto &f : m) {
+        if (!f.isDeclaration() && has_fn_pipeline(f)) {
+            skip = true;
+            break;
+        }
+    }
+
+    if (!skip) {
+        pm.run(m);
+        return;
+    }
+
+    // NOTE: the legacy pass manager does not allow to exclude
+    // functions from the optimisation. Thus, we move the definitions
+    // of the functions to be skipped to a separate module, optimise
+    // the rest and link the two modules back together. This works because
+    // the functions optimised by a fn_pipeline do not call other
+    // functions defined in the module.
+    llvm::ValueToValueMapTy vmap;
+    auto skipped = llvm::CloneModule(m, vmap, [](const llvm::GlobalValue *gv) {
+        const auto *f = llvm::dyn_cast<llvm::Function>(gv);
+        return f != nullptr && has_fn_pipeline(*f);
+    });
+    for (auto &f : m) {
+        if (!f.isDeclaration() && has_fn_pipeline(f)) {
+            f.deleteBody();
+        }
+    }
+
+    pm.run(m);
+
+    if (llvm::Linker::linkModules(m, std::move(skipped))) {
+        throw std::runtime_error("Could not link the functions optimised with custom pipelines into the module '"
+                                 + m.getName().str() + "'");
+    }
+}
+
+} // namespace lambdifier::detail
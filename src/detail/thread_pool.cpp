@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include <lambdifier/detail/thread_pool.hpp>
+
+namespace lambdifier::detail
+{
+
+thread_pool::thread_pool(unsigned n)
+{
+    if (n == 0u) {
+        throw std::invalid_argument("The number of threads in a thread pool must be at least 1");
+    }
+
+    for (auto i = 0u; i < n; ++i) {
+        queues.push_back(std::make_unique<work_queue>());
+    }
+
+    // NOTE: the calling thread takes part in
+    // the evaluation, hence n - 1 workers.
+    try {
+        for (auto i = 0u; i + 1u < n; ++i) {
+            workers.emplace_back(&thread_pool::worker_main, this, i);
+        }
+    } catch (...) {
+        {
+            std::lock_guard lock{m};
+            stop = true;
+        }
+        start_cv.notify_all();
+        for (auto &t : workers) {
+            t.join();
+        }
+        throw;
+    }
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard lock{m};
+        stop = true;
+    }
+    start_cv.notify_all();
+
+    for (auto &t : workers) {
+        t.join();
+    }
+}
+
+unsigned thread_pool::get_n_threads() const
+{
+    return static_cast<unsigned>(queues.size());
+}
+
+// Fetch the next chunk for the thread idx: first from its
+// own queue, then from the queues of the other threads.
+std::optional<thread_pool::range_t> thread_pool::pop(unsigned idx)
+{
+    {
+        auto &q = *queues[idx];
+        std::lock_guard lock{q.m};
+        if (!q.ranges.empty()) {
+            auto r = q.ranges.front();
+            q.ranges.pop_front();
+            return r;
+        }
+    }
+
+    const auto n = get_n_threads();
+    for (auto i = 1u; i < n; ++i) {
+        auto &q = *queues[(idx + i) % n];
+        std::lock_guard lock{q.m};
+        if (!q.ranges.empty()) {
+            auto r = q.ranges.back();
+            q.ranges.pop_back();
+            return r;
+        }
+    }
+
+    return {};
+}
+
+// Process chunks as the thread idx until all the queues are empty.
+// NOTE: all the chunks are enqueued before the workers are
+// woken up, thus empty queues mean that the job is complete
+// (apart from the chunks being processed by other threads).
+void thread_pool::run(unsigned idx)
+{
+    while (auto r = pop(idx)) {
+        if (failed.load(std::memory_order_relaxed)) {
+            continue;
+        }
+
+        try {
+            (*job)(r->first, r->second);
+        } catch (...) {
+            std::lock_guard lock{m};
+            if (!eptr) {
+                eptr = std::current_exception();
+            }
+            failed.store(true, std::memory_order_relaxed);
+        }
+    }
+}
+
+void thread_pool::worker_main(unsigned idx)
+{
+    std::uint64_t cur_gen = 0;
+
+    while (true) {
+        {
+            std::unique_lock lock{m};
+            start_cv.wait(lock, [this, cur_gen]() { return stop || generation != cur_gen; });
+            if (stop) {
+                return;
+            }
+            cur_gen = generation;
+        }
+
+        run(idx);
+
+        {
+            std::lock_guard lock{m};
+            assert(n_active > 0u);
+            if (--n_active == 0u) {
+                done_cv.notify_one();
+            }
+        }
+    }
+}
+
+void thread_pool::parallel_for(std::uint64_t n, std::uint64_t chunk_size, const job_t &f)
+{
+    if (chunk_size == 0u) {
+        throw std::invalid_argument("The chunk size in a parallel evaluation must be at least 1");
+    }
+
+    if (n == 0u) {
+        return;
+    }
+
+    const auto n_chunks = n / chunk_size + static_cast<std::uint64_t>(n % chunk_size != 0u);
+
+    if (workers.empty() || n_chunks == 1u) {
+        // Nothing to parallelise.
+        for (std::uint64_t b = 0; b < n; b += chunk_size) {
+            f(b, b + std::min(chunk_size, n - b));
+        }
+        return;
+    }
+
+    // Assign to each thread a contiguous block of chunks.
+    const auto n_threads = get_n_threads();
+    for (auto i = 0u; i < n_threads; ++i) {
+        const auto c_begin = n_chunks * i / n_threads, c_end = n_chunks * (i + 1u) / n_threads;
+
+        auto &q = *queues[i];
+        std::lock_guard lock{q.m};
+        assert(q.ranges.empty());
+        for (auto c = c_begin; c < c_end; ++c) {
+            const auto b = c * chunk_size;
+            q.ranges.emplace_back(b, b + std::min(chunk_size, n - b));
+        }
+    }
+
+    // Wake up the workers.
+    {
+        std::lock_guard lock{m};
+        job = &f;
+        eptr = nullptr;
+        failed.store(false, std::memory_order_relaxed);
+        n_active = static_cast<unsigned>(workers.size());
+        ++generation;
+    }
+    start_cv.notify_all();
+
+    // The calling thread uses the last queue.
+    run(n_threads - 1u);
+
+    // Wait for the workers to finish.
+    std::exception_ptr e;
+    {
+        std::unique_lock lock{m};
+        done_cv.wait(lock, [this]() { return n_active == 0u; });
+        job = nullptr;
+        e = std::move(eptr);
+        eptr = nullptr;
+    }
+
+    if (e) {
+        std::rethrow_exception(e);
+    }
+}
+
+} // namespace lambdifier::detail
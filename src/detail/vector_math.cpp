@@ -0,0 +1,274 @@
+#include <cassert>
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <string>
+
+#include <llvm/IR/Attributes.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Type.h>
+#include <llvm/IR/Value.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Casting.h>
+
+#include <lambdifier/detail/vector_math.hpp>
+
+namespace lambdifier::detail
+{
+
+namespace
+{
+
+// NOTE: the functions in this file use their own builder without
+// fast-math flags: the argument reductions rely on the exact
+// evaluation order of the floating-point operations.
+
+// Evaluate the polynomial with coefficients cfs
+// (highest degree first) in x via Horner's scheme.
+llvm::Value *horner(llvm::IRBuilder<> &b, llvm::Value *x, std::initializer_list<double> cfs)
+{
+    assert(cfs.size() > 0u);
+
+    auto it = cfs.begin();
+    llvm::Value *retval = llvm::ConstantFP::get(x->getType(), *it);
+    for (++it; it != cfs.end(); ++it) {
+        retval = b.CreateFAdd(b.CreateFMul(retval, x), llvm::ConstantFP::get(x->getType(), *it));
+    }
+
+    return retval;
+}
+
+// Compute 2**n for the vector of integers n,
+// which must be in the normal range of the exponents.
+llvm::Value *pow2(llvm::IRBuilder<> &b, llvm::Value *n, llvm::Type *vt)
+{
+    auto *ivt = n->getType();
+    return b.CreateBitCast(b.CreateShl(b.CreateAdd(n, llvm::ConstantInt::get(ivt, 1023)), 52), vt);
+}
+
+// Return NaN where x is not finite, r otherwise.
+llvm::Value *nan_if_not_finite(llvm::IRBuilder<> &b, llvm::Value *x, llvm::Value *r)
+{
+    // NOTE: x - x is NaN if x is infinity or NaN.
+    return b.CreateSelect(b.CreateFCmpUNO(b.CreateFSub(x, x), x),
+                          llvm::ConstantFP::get(x->getType(), std::numeric_limits<double>::quiet_NaN()), r);
+}
+
+// Cephes' exp().
+llvm::Value *vm_exp(llvm::IRBuilder<> &b, llvm::Value *x, llvm::Type *ivt)
+{
+    auto *vt = x->getType();
+    auto c = [vt](double v) { return llvm::ConstantFP::get(vt, v); };
+
+    // Clamp the argument, so that the exponent is representable.
+    // Outside this range, the result is 0 or infinity.
+    auto *cx = b.CreateSelect(b.CreateFCmpOGT(x, c(710.)), c(710.), x);
+    cx = b.CreateSelect(b.CreateFCmpOLT(cx, c(-746.)), c(-746.), cx);
+
+    // Express exp(x) as exp(r) * 2**n.
+    auto *n = b.CreateUnaryIntrinsic(llvm::Intrinsic::floor,
+                                     b.CreateFAdd(b.CreateFMul(cx, c(1.4426950408889634073599)), c(.5)));
+    auto *r = b.CreateFSub(cx, b.CreateFMul(n, c(6.93145751953125E-1)));
+    r = b.CreateFSub(r, b.CreateFMul(n, c(1.42860682030941723212E-6)));
+
+    // Rational approximation of exp(r) in [-0.5 * ln(2), 0.5 * ln(2)].
+    auto *rr = b.CreateFMul(r, r);
+    auto *px = b.CreateFMul(
+        r, horner(b, rr, {1.26177193074810590878E-4, 3.02994407707441961300E-2, 9.99999999999999999910E-1}));
+    auto *qx = horner(b, rr,
+                      {3.00198505138664455042E-6, 2.52448340349684104192E-3, 2.27265548208155028766E-1,
+                       2.00000000000000000009E0});
+    r = b.CreateFDiv(px, b.CreateFSub(qx, px));
+    r = b.CreateFAdd(c(1.), b.CreateFMul(c(2.), r));
+
+    // Multiply by 2**n in two steps, in order to
+    // deal with overflow and subnormal results.
+    auto *ni = b.CreateFPToSI(n, ivt);
+    auto *n1 = b.CreateAShr(ni, 1);
+    auto *n2 = b.CreateSub(ni, n1);
+    auto *retval = b.CreateFMul(b.CreateFMul(r, pow2(b, n1, vt)), pow2(b, n2, vt));
+
+    // Propagate NaNs.
+    return b.CreateSelect(b.CreateFCmpUNO(x, x), x, retval);
+}
+
+// Cephes' log().
+llvm::Value *vm_log(llvm::IRBuilder<> &b, llvm::Value *x, llvm::Type *ivt)
+{
+    auto *vt = x->getType();
+    auto c = [vt](double v) { return llvm::ConstantFP::get(vt, v); };
+    auto ic = [ivt](std::uint64_t v) { return llvm::ConstantInt::get(ivt, v); };
+
+    // Scale the subnormal numbers into the normal range.
+    auto *is_sub = b.CreateFCmpOLT(x, c(std::numeric_limits<double>::min()));
+    auto *sx = b.CreateSelect(is_sub, b.CreateFMul(x, c(18014398509481984.)), x);
+
+    // Decompose the argument as m * 2**e, with m in [0.5, 1).
+    auto *bits = b.CreateBitCast(sx, ivt);
+    auto *e = b.CreateSub(b.CreateAnd(b.CreateLShr(bits, 52), ic(0x7ff)), ic(1022));
+    e = b.CreateSelect(is_sub, b.CreateSub(e, ic(54)), e);
+    auto *m = b.CreateBitCast(b.CreateOr(b.CreateAnd(bits, ic(0x000fffffffffffffull)), ic(0x3fe0000000000000ull)), vt);
+
+    // Move m into [sqrt(0.5) - 1, sqrt(2) - 1).
+    auto *lt = b.CreateFCmpOLT(m, c(0.70710678118654752440));
+    e = b.CreateSelect(lt, b.CreateSub(e, ic(1)), e);
+    m = b.CreateSelect(lt, b.CreateFSub(b.CreateFAdd(m, m), c(1.)), b.CreateFSub(m, c(1.)));
+    auto *ef = b.CreateSIToFP(e, vt);
+
+    // Rational approximation of log(1 + m).
+    auto *z = b.CreateFMul(m, m);
+    auto *p = horner(b, m,
+                     {1.01875663804580931796E-4, 4.97494994976747001425E-1, 4.70579119878881725854E0,
+                      1.44989225341610930846E1, 1.79368678507819816313E1, 7.70838733755885391666E0});
+    auto *q = horner(b, m,
+                     {1., 1.12873587189167450590E1, 4.52279145837532221105E1, 8.29875266912776603211E1,
+                      7.11544750618563894466E1, 2.31251620126765340583E1});
+    auto *y = b.CreateFDiv(b.CreateFMul(b.CreateFMul(m, z), p), q);
+    y = b.CreateFSub(y, b.CreateFMul(ef, c(2.121944400546905827679e-4)));
+    y = b.CreateFSub(y, b.CreateFMul(c(.5), z));
+    auto *retval = b.CreateFAdd(m, y);
+    retval = b.CreateFAdd(retval, b.CreateFMul(ef, c(0.693359375)));
+
+    // Special values.
+    retval = b.CreateSelect(b.CreateFCmpOEQ(x, c(0.)), c(-std::numeric_limits<double>::infinity()), retval);
+    retval = b.CreateSelect(b.CreateFCmpOEQ(x, c(std::numeric_limits<double>::infinity())), x, retval);
+    return b.CreateSelect(b.CreateFCmpULT(x, c(0.)), c(std::numeric_limits<double>::quiet_NaN()), retval);
+}
+
+// Cephes' sin() and cos().
+llvm::Value *vm_sincos(llvm::IRBuilder<> &b, llvm::Value *x, llvm::Type *ivt, bool is_sin)
+{
+    auto *vt = x->getType();
+    auto c = [vt](double v) { return llvm::ConstantFP::get(vt, v); };
+    auto ic = [ivt](std::uint64_t v) { return llvm::ConstantInt::get(ivt, v); };
+
+    auto *ax = b.CreateUnaryIntrinsic(llvm::Intrinsic::fabs, x);
+
+    // NOTE: above 2**30, the argument reduction loses accuracy (and
+    // above 2**63 the conversion of the octant to integer overflows).
+    // Thus, if any lane is above the limit (or infinite), we evaluate
+    // the whole vector via the scalar functions of the math library.
+    const auto n_lanes = llvm::cast<llvm::VectorType>(vt)->getNumElements();
+    auto *large = b.CreateFCmpOGT(ax, c(1073741824.));
+    auto *any_large = b.CreateICmpNE(b.CreateBitCast(large, b.getIntNTy(n_lanes)), b.getIntN(n_lanes, 0));
+
+    auto *f = b.GetInsertBlock()->getParent();
+    auto *large_bb = llvm::BasicBlock::Create(b.getContext(), "large_args", f);
+    auto *reduce_bb = llvm::BasicBlock::Create(b.getContext(), "reduce", f);
+    auto *end_bb = llvm::BasicBlock::Create(b.getContext(), "end", f);
+    b.CreateCondBr(any_large, large_bb, reduce_bb);
+
+    b.SetInsertPoint(large_bb);
+    llvm::Value *large_retval = llvm::UndefValue::get(vt);
+    for (unsigned i = 0; i < n_lanes; ++i) {
+        large_retval = b.CreateInsertElement(
+            large_retval,
+            b.CreateUnaryIntrinsic(is_sin ? llvm::Intrinsic::sin : llvm::Intrinsic::cos, b.CreateExtractElement(x, i)),
+            i);
+    }
+    b.CreateBr(end_bb);
+
+    b.SetInsertPoint(reduce_bb);
+
+    // Reduce the argument to [-pi / 4, pi / 4]: j is the octant
+    // (rounded to the next even number).
+    auto *j = b.CreateFPToSI(b.CreateFMul(ax, c(1.27323954473516268615)), ivt);
+    j = b.CreateAdd(j, b.CreateAnd(j, ic(1)));
+    auto *y = b.CreateSIToFP(j, vt);
+    auto *z = b.CreateFSub(ax, b.CreateFMul(y, c(7.85398125648498535156E-1)));
+    z = b.CreateFSub(z, b.CreateFMul(y, c(3.77489470793079817668E-8)));
+    z = b.CreateFSub(z, b.CreateFMul(y, c(2.69515142907905952645E-15)));
+
+    // Determine the sign of the result and the
+    // polynomial to be used from the octant.
+    j = b.CreateAnd(j, ic(7));
+    auto *gt3 = b.CreateICmpUGT(j, ic(3));
+    j = b.CreateSelect(gt3, b.CreateSub(j, ic(4)), j);
+    llvm::Value *flip;
+    if (is_sin) {
+        flip = b.CreateXor(gt3, b.CreateFCmpOLT(x, c(0.)));
+    } else {
+        flip = b.CreateXor(gt3, b.CreateICmpUGT(j, ic(1)));
+    }
+    auto *mid = b.CreateOr(b.CreateICmpEQ(j, ic(1)), b.CreateICmpEQ(j, ic(2)));
+
+    auto *zz = b.CreateFMul(z, z);
+    auto *ps = b.CreateFAdd(
+        z, b.CreateFMul(b.CreateFMul(z, zz),
+                        horner(b, zz,
+                               {1.58962301576546568060E-10, -2.50507477628578072866E-8, 2.75573136213857245213E-6,
+                                -1.98412698295895385996E-4, 8.33333333332211858878E-3,
+                                -1.66666666666666307295E-1})));
+    auto *pc = b.CreateFAdd(
+        b.CreateFSub(c(1.), b.CreateFMul(c(.5), zz)),
+        b.CreateFMul(b.CreateFMul(zz, zz),
+                     horner(b, zz,
+                            {-1.13585365213876817300E-11, 2.08757008419747316778E-9, -2.75573141792967388112E-7,
+                             2.48015872888517045348E-5, -1.38888888888730564116E-3, 4.16666666666665929218E-2})));
+
+    auto *retval = is_sin ? b.CreateSelect(mid, pc, ps) : b.CreateSelect(mid, ps, pc);
+    retval = b.CreateSelect(flip, b.CreateFNeg(retval), retval);
+    retval = nan_if_not_finite(b, x, retval);
+    b.CreateBr(end_bb);
+
+    b.SetInsertPoint(end_bb);
+    auto *phi = b.CreatePHI(vt, 2);
+    phi->addIncoming(large_retval, large_bb);
+    phi->addIncoming(retval, reduce_bb);
+
+    return phi;
+}
+
+} // namespace
+
+llvm::Function *vector_math_function(llvm::Module &m, const std::string &name, llvm::Type *vt)
+{
+    if (name != "exp" && name != "log" && name != "sin" && name != "cos") {
+        return nullptr;
+    }
+
+    // NOTE: only double precision is supported.
+    if (!vt->getScalarType()->isDoubleTy()) {
+        return nullptr;
+    }
+
+    const auto n_lanes = llvm::cast<llvm::VectorType>(vt)->getNumElements();
+    const auto fname = "lambdifier.vm." + name + ".v" + std::to_string(n_lanes) + "f64";
+
+    if (auto *f = m.getFunction(fname)) {
+        return f;
+    }
+
+    auto &ctx = m.getContext();
+    auto *ft = llvm::FunctionType::get(vt, {vt}, false);
+    auto *f = llvm::Function::Create(ft, llvm::Function::InternalLinkage, fname, &m);
+    assert(f != nullptr);
+    f->addFnAttr(llvm::Attribute::NoUnwind);
+    f->addFnAttr(llvm::Attribute::ReadNone);
+
+    llvm::IRBuilder<> b(llvm::BasicBlock::Create(ctx, "entry", f));
+    auto *x = &*f->args().begin();
+    auto *ivt = llvm::VectorType::get(b.getInt64Ty(), n_lanes);
+
+    llvm::Value *retval;
+    if (name == "exp") {
+        retval = vm_exp(b, x, ivt);
+    } else if (name == "log") {
+        retval = vm_log(b, x, ivt);
+    } else {
+        retval = vm_sincos(b, x, ivt, name == "sin");
+    }
+    b.CreateRet(retval);
+
+    assert(!llvm::verifyFunction(*f));
+
+    return f;
+}
+
+} // namespace lambdifier::detail
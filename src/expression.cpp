@@ -1,5 +1,7 @@
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <ostream>
 #include <stdexcept>
 #include <string>
@@ -18,6 +20,7 @@
 #include <lambdifier/function_call.hpp>
 #include <lambdifier/llvm_state.hpp>
 #include <lambdifier/number.hpp>
+#include <lambdifier/param.hpp>
 #include <lambdifier/variable.hpp>
 
 namespace lambdifier
@@ -113,6 +116,12 @@ bool expression::operator==(const expression &other) const
         } else {
             return false;
         }
+    } else if (auto par_ptr = extract<param>()) {
+        if (auto par_ptr_other = other.extract<param>()) {
+            return par_ptr->get_index() == par_ptr_other->get_index();
+        } else {
+            return false;
+        }
     } else {
         // throw?
         return false;
@@ -124,6 +133,49 @@ bool expression::operator!=(const expression &other) const
     return !(*this == other);
 }
 
+namespace detail
+{
+
+namespace
+{
+
+// Combine the hash value h into seed (the same
+// scheme used by boost::hash_combine()).
+void hash_combine(std::size_t &seed, std::size_t h)
+{
+    seed ^= h + std::size_t(0x9e3779b9ul) + (seed << 6) + (seed >> 2);
+}
+
+} // namespace
+
+} // namespace detail
+
+// Structural hash of the expression: expressions which compare
+// equal via operator==() have the same hash value.
+std::size_t expression::hash() const
+{
+    std::size_t retval = 0;
+
+    if (auto bo_ptr = extract<binary_operator>()) {
+        detail::hash_combine(retval, std::hash<char>{}(bo_ptr->get_op()));
+        detail::hash_combine(retval, bo_ptr->get_lhs().hash());
+        detail::hash_combine(retval, bo_ptr->get_rhs().hash());
+    } else if (auto fun_ptr = extract<function_call>()) {
+        detail::hash_combine(retval, std::hash<std::string>{}(fun_ptr->get_name()));
+        for (const auto &arg : fun_ptr->get_args()) {
+            detail::hash_combine(retval, arg.hash());
+        }
+    } else if (auto num_ptr = extract<number>()) {
+        detail::hash_combine(retval, std::hash<double>{}(num_ptr->get_value()));
+    } else if (auto var_ptr = extract<variable>()) {
+        detail::hash_combine(retval, std::hash<std::string>{}(var_ptr->get_name()));
+    } else if (auto par_ptr = extract<param>()) {
+        detail::hash_combine(retval, std::hash<std::string>{}(par_ptr->to_string()));
+    }
+
+    return retval;
+}
+
 std::string expression::to_string() const
 {
     return m_ptr->to_string();
@@ -219,6 +271,23 @@ std::vector<std::string> expression::get_variables() const
     return retval;
 }
 
+std::uint64_t expression::get_n_params() const
+{
+    if (auto bo_ptr = extract<binary_operator>()) {
+        return std::max(bo_ptr->get_lhs().get_n_params(), bo_ptr->get_rhs().get_n_params());
+    } else if (auto par_ptr = extract<param>()) {
+        return static_cast<std::uint64_t>(par_ptr->get_index()) + 1u;
+    } else if (auto call_ptr = extract<function_call>()) {
+        std::uint64_t retval = 0;
+        for (const auto &ex : call_ptr->get_args()) {
+            retval = std::max(retval, ex.get_n_params());
+        }
+        return retval;
+    }
+
+    return 0;
+}
+
 expression operator+(expression e1, expression e2)
 {
     if (auto e1_nptr = e1.extract<number>(), e2_nptr = e2.extract<number>(); e1_nptr && e2_nptr) {
@@ -375,6 +444,11 @@ void taylor_decompose_ex(expression &ex, std::vector<expression> &u_vars_defs)
         // NOTE: an expression does *not* require decomposition
         // if it is a variable or a number.
         return;
+    } else if (auto par_ptr = ex.extract<param>()) {
+        // NOTE: a parameter is assigned to its own u variable, so that
+        // the derivatives of the other u variables never involve
+        // parameters directly.
+        u_vars_defs.emplace_back(*par_ptr);
     } else if (auto bo_ptr = ex.extract<binary_operator>()) {
         // Variables to track how the size
         // of u_vars_defs changes after the decomposition
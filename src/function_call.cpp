@@ -5,12 +5,16 @@
 #include <vector>
 
 #include <llvm/IR/Attributes.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/Value.h>
 
 #include <lambdifier/detail/check_symbol_name.hpp>
+#include <lambdifier/detail/vector_math.hpp>
 #include <lambdifier/expression.hpp>
 #include <lambdifier/function_call.hpp>
 #include <lambdifier/llvm_state.hpp>
@@ -137,6 +141,66 @@ void function_call::set_diff_f(diff_t f)
     diff_f = std::move(f);
 }
 
+namespace detail
+{
+
+namespace
+{
+
+// Emit a call to the function f of type ty in vector mode,
+// where the arguments in args_v are vectors of doubles.
+llvm::Value *vector_call(llvm_state &s, llvm::Function *f, function_call::type ty,
+                         const std::vector<llvm::Value *> &args_v)
+{
+    auto &builder = s.get_builder();
+    const auto width = s.get_codegen_width();
+    auto *vt = llvm::VectorType::get(s.get_fp_type(), width);
+
+    if (ty == function_call::type::builtin) {
+        // Use our vectorised implementations of the elementary
+        // functions, if available. Otherwise, fall back to the
+        // vector version of the intrinsic.
+        // NOTE: the vector intrinsics with no native
+        // instruction are scalarised by the backend.
+        const auto name = f->getName().str();
+        if (args_v.size() == 1u && name.rfind("llvm.", 0) == 0) {
+            if (auto *vm_f = vector_math_function(s.get_module(), name.substr(5), vt)) {
+                auto r = builder.CreateCall(vm_f, args_v, "vcalltmp");
+                r->setTailCall(true);
+                return r;
+            }
+        }
+
+        auto *vf = llvm::Intrinsic::getDeclaration(&s.get_module(), f->getIntrinsicID(), {vt});
+        if (!vf) {
+            throw std::invalid_argument("Error getting the vector declaration of the intrinsic '" + name + "'");
+        }
+        auto r = builder.CreateCall(vf, args_v, "vcalltmp");
+        r->setTailCall(true);
+        return r;
+    }
+
+    // Internal and external functions are scalar,
+    // invoke them separately on each lane.
+    llvm::Value *retval = llvm::UndefValue::get(vt);
+    for (unsigned k = 0; k < width; ++k) {
+        std::vector<llvm::Value *> lane_args;
+        lane_args.reserve(args_v.size());
+        for (auto *arg : args_v) {
+            lane_args.push_back(builder.CreateExtractElement(arg, k));
+        }
+        auto r = builder.CreateCall(f, lane_args, "calltmp");
+        r->setTailCall(true);
+        retval = builder.CreateInsertElement(retval, r, k);
+    }
+
+    return retval;
+}
+
+} // namespace
+
+} // namespace detail
+
 llvm::Value *function_call::codegen(llvm_state &s) const
 {
     if (disable_verify) {
@@ -159,26 +223,30 @@ llvm::Value *function_call::codegen(llvm_state &s) const
             throw std::invalid_argument("The internal function '" + name + "' is empty");
         }
     } else if (ty == type::external) {
+        // NOTE: in single precision, use the float version
+        // of the function (e.g., tanf() instead of tan()).
+        const auto ext_name = s.get_single_precision() ? name + "f" : name;
+
         // Look up the name in the global module table.
-        callee_f = s.get_module().getFunction(name);
+        callee_f = s.get_module().getFunction(ext_name);
 
         if (callee_f) {
             // The function declaration exists already. Check that it is only a
             // declaration and not a definition.
             if (!callee_f->empty()) {
                 throw std::invalid_argument(
-                    "Cannot call the function '" + name
+                    "Cannot call the function '" + ext_name
                     + "' as an external function, because it is defined as an internal module function");
             }
         } else {
             // The function does not exist yet, make the prototype.
-            detail::check_symbol_name(name);
-            std::vector<llvm::Type *> doubles(args.size(), s.get_builder().getDoubleTy());
-            auto *ft = llvm::FunctionType::get(s.get_builder().getDoubleTy(), doubles, false);
-            callee_f = llvm::Function::Create(ft, llvm::Function::ExternalLinkage, name, &s.get_module());
+            detail::check_symbol_name(ext_name);
+            std::vector<llvm::Type *> fp_args(args.size(), s.get_fp_type());
+            auto *ft = llvm::FunctionType::get(s.get_fp_type(), fp_args, false);
+            callee_f = llvm::Function::Create(ft, llvm::Function::ExternalLinkage, ext_name, &s.get_module());
 
             if (!callee_f) {
-                throw std::invalid_argument("The creation of the prototype of the external function '" + name
+                throw std::invalid_argument("The creation of the prototype of the external function '" + ext_name
                                             + "' failed");
             }
 
@@ -198,9 +266,9 @@ llvm::Value *function_call::codegen(llvm_state &s) const
         // the desired argument types. See:
         // https://stackoverflow.com/questions/11985247/llvm-insert-intrinsic-function-cos
         // And the docs of the getDeclaration() function.
-        const std::vector<llvm::Type *> doubles(args.size(), s.get_builder().getDoubleTy());
+        const std::vector<llvm::Type *> fp_args(args.size(), s.get_fp_type());
 
-        callee_f = llvm::Intrinsic::getDeclaration(&s.get_module(), intrinsic_ID, doubles);
+        callee_f = llvm::Intrinsic::getDeclaration(&s.get_module(), intrinsic_ID, fp_args);
 
         if (!callee_f) {
             throw std::invalid_argument("Error getting the declaration of the intrinsic '" + name + "'");
@@ -228,6 +296,10 @@ llvm::Value *function_call::codegen(llvm_state &s) const
         }
     }
 
+    if (s.get_codegen_width() > 1u) {
+        return detail::vector_call(s, callee_f, ty, args_v);
+    }
+
     auto r = s.get_builder().CreateCall(callee_f, args_v, "calltmp");
     // NOTE: not sure what this does exactly, but the optimized
     // IR from clang has this.
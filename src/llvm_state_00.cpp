@@ -1,49 +1,387 @@
+#include <algorithm>
+#include <bit>
 #include <cassert>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <future>
 #include <initializer_list>
+#include <iostream>
+#include <iterator>
 #include <limits>
+#include <optional>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/Config/llvm-config.h>
 #include <llvm/IR/Attributes.h>
 #include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/InstrTypes.h>
+#include <llvm/IR/Instructions.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Operator.h>
+#include <llvm/IR/PassTimingInfo.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/Value.h>
 #include <llvm/IR/Verifier.h>
+#include <llvm/Pass.h>
 #include <llvm/Support/Error.h>
+#include <llvm/Support/Host.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
 #include <llvm/Transforms/IPO.h>
 #include <llvm/Transforms/IPO/PassManagerBuilder.h>
 #include <llvm/Transforms/InstCombine/InstCombine.h>
 #include <llvm/Transforms/Scalar.h>
 #include <llvm/Transforms/Scalar/GVN.h>
 #include <llvm/Transforms/Utils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
 #include <llvm/Transforms/Vectorize.h>
 
 #include <lambdifier/detail/check_symbol_name.hpp>
+#include <lambdifier/detail/pipeline.hpp>
+#include <lambdifier/detail/scoped_timer.hpp>
+#include <lambdifier/detail/thread_pool.hpp>
+#include <lambdifier/binary_operator.hpp>
 #include <lambdifier/expression.hpp>
+#include <lambdifier/function_call.hpp>
 #include <lambdifier/llvm_state.hpp>
+#include <lambdifier/number.hpp>
 
 namespace lambdifier
 {
 
-llvm_state::llvm_state(const std::string &name, unsigned l) : opt_level(l)
+namespace detail
 {
-    // Create the module.
-    module = std::make_unique<llvm::Module>(name, get_context());
-    module->setDataLayout(jitter.get_data_layout());
+
+namespace
+{
+
+// Helper to set up a PassManagerBuilder
+// for the optimisation level l and the target machine tm.
+void init_pm_builder(llvm::PassManagerBuilder &pm_builder, unsigned l, llvm::TargetMachine &tm)
+{
+    // See here for the defaults:
+    // https://llvm.org/doxygen/PassManagerBuilder_8cpp_source.html
+    pm_builder.OptLevel = l;
+    pm_builder.VerifyInput = true;
+    pm_builder.VerifyOutput = true;
+    pm_builder.Inliner = llvm::createFunctionInliningPass();
+    if (l >= 3u) {
+        pm_builder.SLPVectorize = true;
+        pm_builder.MergeFunctions = true;
+    }
+    // Add the target-specific passes.
+    tm.adjustPassManager(pm_builder);
+}
+
+// Create the module-level optimizer for the optimisation
+// level l and the target machine tm. See:
+// https://stackoverflow.com/questions/48300510/llvm-api-optimisation-run
+std::unique_ptr<llvm::legacy::PassManager> create_module_pm(unsigned l, llvm::TargetMachine &tm)
+{
+    auto retval = std::make_unique<llvm::legacy::PassManager>();
+    // NOTE: without the target-specific analyses, the
+    // optimisation passes (e.g., the vectorizers) would
+    // assume a generic target without vector registers.
+    retval->add(llvm::createTargetTransformInfoWrapperPass(tm.getTargetIRAnalysis()));
+    llvm::PassManagerBuilder pm_builder;
+    init_pm_builder(pm_builder, l, tm);
+    pm_builder.populateModulePassManager(*retval);
+
+    return retval;
+}
+
+// The multiversioned variants of the batch functions.
+struct batch_variant {
+    // Suffix appended to the name of the batch function.
+    const char *suffix;
+    // Target CPU and features.
+    const char *cpu;
+    const char *features;
+    // Preferred width (in bits) of the vector registers.
+    const char *vector_width;
+};
+
+// NOTE: the variants are ordered by increasing capabilities.
+constexpr batch_variant batch_variants[] = {{".avx2", "haswell", "+avx,+avx2,+fma", "256"},
+                                            {".avx512", "skylake-avx512",
+                                             "+avx,+avx2,+fma,+avx512f,+avx512dq,+avx512cd,+avx512bw,+avx512vl",
+                                             "512"}};
+
+// The suffixes of the batch functions (including
+// the loss kernels) generated by add_expression().
+constexpr const char *batch_suffixes[] = {".batch",         ".batch_soa",  ".batch_n",   ".batch_soa_n",
+                                          ".batch_strided", ".batch_cols", ".loss_sse", ".loss_mae",
+                                          ".loss_max_abs"};
+
+// The name of the automatic pipeline of level l.
+// NOTE: at the lowest level, we still run a minimal cleanup
+// of the IR, which is much cheaper than the codegen of
+// the unoptimised IR.
+std::string auto_pipeline_name(std::size_t l)
+{
+    return l == 0u ? "cleanup" : "O" + std::to_string(l);
+}
+
+// The suffixes of all the functions which may be
+// generated by add_expression() for an expression.
+std::vector<std::string> alias_suffixes()
+{
+    std::vector<std::string> retval{"", ".vecargs"};
+    for (const auto *batch_suffix : batch_suffixes) {
+        retval.emplace_back(batch_suffix);
+        for (const auto &bv : batch_variants) {
+            retval.push_back(batch_suffix + std::string{bv.suffix});
+        }
+    }
+
+    return retval;
+}
+
+// The suffix of the loss kernel of type lt.
+const char *loss_suffix(llvm_state::loss_type lt)
+{
+    switch (lt) {
+        case llvm_state::loss_type::sse:
+            return ".loss_sse";
+        case llvm_state::loss_type::mae:
+            return ".loss_mae";
+        case llvm_state::loss_type::max_abs:
+            return ".loss_max_abs";
+    }
+
+    throw std::invalid_argument("Invalid loss type: " + std::to_string(static_cast<int>(lt)));
+}
+
+// The number of partial accumulators in the loss
+// kernels, if the SIMD width is 1.
+constexpr unsigned loss_acc_width = 4;
+
+// Set the alignment of the load or store inst to a.
+template <typename Inst>
+void set_alignment(Inst *inst, unsigned a)
+{
+#if LLVM_VERSION_MAJOR == 10
+    inst->setAlignment(llvm::MaybeAlign(a));
+#else
+    inst->setAlignment(a);
+#endif
+}
+
+// Check if the host CPU supports all the features
+// in the string fs (e.g., "+avx2,+fma").
+bool host_supports(const char *fs)
+{
+    static const auto host_features = []() {
+        llvm::StringMap<bool> retval;
+        if (!llvm::sys::getHostCPUFeatures(retval)) {
+            retval.clear();
+        }
+        return retval;
+    }();
+
+    llvm::SmallVector<llvm::StringRef, 8> feats;
+    llvm::StringRef(fs).split(feats, ',', -1, false);
+    for (auto feat : feats) {
+        if (feat.consume_front("+")) {
+            const auto it = host_features.find(feat);
+            if (it == host_features.end() || !it->getValue()) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Clone the function f, appending suffix to the name of the clone.
+// The functions defined in the module and invoked by f are cloned as
+// well (recursively), so that the whole call tree of the clone can be
+// compiled for a different target. The clones of the callees have internal
+// linkage. The new functions are appended to clones.
+llvm::Function *clone_call_tree(llvm::Function &f, const std::string &suffix, llvm::ValueToValueMapTy &vmap,
+                                std::vector<llvm::Function *> &clones)
+{
+    // Clone the callees first, so that the calls
+    // in the clone of f are remapped to their clones.
+    for (auto &bb : f) {
+        for (auto &inst : bb) {
+            if (auto *call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
+                auto *callee = call->getCalledFunction();
+                if (callee != nullptr && !callee->isDeclaration() && vmap.find(callee) == vmap.end()) {
+                    clone_call_tree(*callee, suffix, vmap, clones)->setLinkage(llvm::Function::InternalLinkage);
+                }
+            }
+        }
+    }
+
+    auto *retval = llvm::CloneFunction(&f, vmap);
+    retval->setName(f.getName() + suffix);
+    vmap[&f] = retval;
+    clones.push_back(retval);
+
+    return retval;
+}
+
+// Hash and equality of expressions for the deduplication.
+// NOTE: unlike expression::hash() and operator==(), the numbers are compared
+// bitwise, as numbers which compare equal (e.g., 0. and -0.) may lead to
+// different results.
+void dedup_hash_combine(std::size_t &seed, std::size_t h)
+{
+    seed ^= h + std::size_t(0x9e3779b9ul) + (seed << 6) + (seed >> 2);
+}
+
+std::size_t dedup_hash(const expression &e)
+{
+    std::size_t retval = 0;
+
+    if (auto bo_ptr = e.extract<binary_operator>()) {
+        dedup_hash_combine(retval, std::hash<char>{}(bo_ptr->get_op()));
+        dedup_hash_combine(retval, dedup_hash(bo_ptr->get_lhs()));
+        dedup_hash_combine(retval, dedup_hash(bo_ptr->get_rhs()));
+    } else if (auto fun_ptr = e.extract<function_call>()) {
+        dedup_hash_combine(retval, std::hash<std::string>{}(fun_ptr->get_name()));
+        for (const auto &arg : fun_ptr->get_args()) {
+            dedup_hash_combine(retval, dedup_hash(arg));
+        }
+    } else if (auto num_ptr = e.extract<number>()) {
+        dedup_hash_combine(retval, std::hash<std::uint64_t>{}(std::bit_cast<std::uint64_t>(num_ptr->get_value())));
+    } else {
+        // NOTE: variables and parameters are
+        // hashed via their string representation.
+        dedup_hash_combine(retval, std::hash<std::string>{}(e.to_string()));
+    }
+
+    return retval;
+}
+
+bool dedup_equal(const expression &a, const expression &b)
+{
+    if (auto bo_ptr = a.extract<binary_operator>()) {
+        auto bo_ptr_b = b.extract<binary_operator>();
+        return bo_ptr_b != nullptr && bo_ptr->get_op() == bo_ptr_b->get_op()
+               && dedup_equal(bo_ptr->get_lhs(), bo_ptr_b->get_lhs())
+               && dedup_equal(bo_ptr->get_rhs(), bo_ptr_b->get_rhs());
+    } else if (auto fun_ptr = a.extract<function_call>()) {
+        auto fun_ptr_b = b.extract<function_call>();
+        return fun_ptr_b != nullptr && fun_ptr->get_name() == fun_ptr_b->get_name()
+               && std::equal(fun_ptr->get_args().begin(), fun_ptr->get_args().end(), fun_ptr_b->get_args().begin(),
+                             fun_ptr_b->get_args().end(), dedup_equal);
+    } else if (auto num_ptr = a.extract<number>()) {
+        auto num_ptr_b = b.extract<number>();
+        return num_ptr_b != nullptr
+               && std::bit_cast<std::uint64_t>(num_ptr->get_value())
+                      == std::bit_cast<std::uint64_t>(num_ptr_b->get_value());
+    }
+
+    return a == b;
+}
+
+} // namespace
+
+} // namespace detail
+
+struct llvm_state::dedup_entry {
+    std::size_t hash;
+    expression ex;
+    unsigned batch_size;
+    bool batch_soa;
+    bool batch_strided;
+    bool single_precision;
+    bool loss_kernels;
+    bool batch_multiversioning;
+    unsigned simd_width;
+    std::string target_cpu;
+    std::string target_features;
+    bool with_params;
+    // The name of the optimisation
+    // pipeline (empty for the default one).
+    std::string pipeline;
+    std::string name;
+    // The unit containing the compiled code (empty
+    // for the expressions in the current module).
+    std::optional<unit_id> unit;
+    // The module being compiled asynchronously which contains
+    // the expression (null if none). The unit will be known
+    // only when the compilation completes.
+    std::shared_ptr<async_unit> async;
+};
+
+struct llvm_state::async_unit {
+    std::mutex mutex;
+    // The names which will be defined in the JIT by the unit.
+    std::unordered_set<std::string> names;
+    // The aliases to the functions of the unit which were
+    // requested while the unit was being compiled.
+    std::vector<std::pair<std::string, std::string>> aliases;
+    // Completion flag, and the id of the
+    // unit (empty if the compilation failed).
+    bool done = false;
+    std::optional<unit_id> unit;
+};
+
+llvm_state::llvm_state(const std::string &name, unsigned l) : llvm_state(name, std::make_shared<detail::jit>(), l) {}
+
+llvm_state::llvm_state(const std::string &name, const llvm_state &other, unsigned l)
+    : llvm_state(name, other.jitter, l)
+{
+}
+
+llvm_state::llvm_state(const std::string &name, std::shared_ptr<detail::jit> j, unsigned l)
+    : jitter(std::move(j)), tm(jitter->create_target_machine()), module_name(name), opt_level(l),
+      eval_threads(std::max(1u, std::thread::hardware_concurrency()))
+{
+    // Create the module and the builder.
+    reset_module();
+
+    // Create the module-level optimizer.
+    if (opt_level > 0u) {
+        pm = detail::create_module_pm(opt_level, *tm);
+    }
+}
+
+// Create a new empty module in a new context, together with the
+// builder and the function pass manager operating on it. This is used
+// both during construction and after each compile() invocation, so that
+// further functions can be added to the same state.
+void llvm_state::reset_module()
+{
+    // NOTE: destroy the objects depending on
+    // the current context before replacing it.
+    fpm.reset();
+    builder.reset();
+    module.reset();
+    named_values.clear();
+    module_entries.clear();
+    pending_aliases.clear();
+
+    ctx = llvm::orc::ThreadSafeContext(std::make_unique<llvm::LLVMContext>());
+
+    module = std::make_unique<llvm::Module>(module_name, get_context());
+    module->setDataLayout(jitter->get_data_layout());
+    module->setTargetTriple(jitter->get_target_triple());
 
     // Create a new builder for the module.
     builder = std::make_unique<llvm::IRBuilder<>>(get_context());
@@ -53,10 +391,11 @@ llvm_state::llvm_state(const std::string &name, unsigned l) : opt_level(l)
     fmf.setFast();
     builder->setFastMathFlags(fmf);
 
-    // Create the optimization passes.
+    // NOTE: the function pass manager is tied to
+    // a specific module, thus we need to re-create it.
     if (opt_level > 0u) {
-        // Create the function pass manager.
         fpm = std::make_unique<llvm::legacy::FunctionPassManager>(module.get());
+        fpm->add(llvm::createTargetTransformInfoWrapperPass(tm->getTargetIRAnalysis()));
         fpm->add(llvm::createPromoteMemoryToRegisterPass());
         fpm->add(llvm::createInstructionCombiningPass());
         fpm->add(llvm::createReassociatePass());
@@ -66,24 +405,12 @@ llvm_state::llvm_state(const std::string &name, unsigned l) : opt_level(l)
         fpm->add(llvm::createSLPVectorizerPass());
         fpm->add(llvm::createLoadStoreVectorizerPass());
         fpm->add(llvm::createLoopUnrollPass());
-        fpm->doInitialization();
 
-        // The module-level optimizer. See:
-        // https://stackoverflow.com/questions/48300510/llvm-api-optimisation-run
-        pm = std::make_unique<llvm::legacy::PassManager>();
         llvm::PassManagerBuilder pm_builder;
-        // See here for the defaults:
-        // https://llvm.org/doxygen/PassManagerBuilder_8cpp_source.html
-        pm_builder.OptLevel = opt_level;
-        pm_builder.VerifyInput = true;
-        pm_builder.VerifyOutput = true;
-        pm_builder.Inliner = llvm::createFunctionInliningPass();
-        if (opt_level >= 3u) {
-            pm_builder.SLPVectorize = true;
-            pm_builder.MergeFunctions = true;
-        }
-        pm_builder.populateModulePassManager(*pm);
+        detail::init_pm_builder(pm_builder, opt_level, *tm);
         pm_builder.populateFunctionPassManager(*fpm);
+
+        fpm->doInitialization();
     }
 }
 
@@ -91,7 +418,7 @@ llvm_state::~llvm_state() = default;
 
 llvm::LLVMContext &llvm_state::get_context()
 {
-    return jitter.get_context();
+    return *ctx.getContext();
 }
 
 llvm::IRBuilder<> &llvm_state::get_builder()
@@ -109,6 +436,11 @@ std::unordered_map<std::string, llvm::Value *> &llvm_state::get_named_values()
     return named_values;
 }
 
+llvm::Value *llvm_state::get_param_values()
+{
+    return param_values;
+}
+
 std::string llvm_state::dump() const
 {
     std::string out;
@@ -132,18 +464,20 @@ void llvm_state::add_varargs_expression(const std::string &name, const expressio
                                         const std::vector<std::string> &vars)
 {
     // Prepare the function prototype. First the function arguments.
-    std::vector<llvm::Type *> fargs(vars.size(), builder->getDoubleTy());
+    std::vector<llvm::Type *> fargs(vars.size(), get_fp_type());
+    add_param_arg(fargs);
     // Then the return type.
-    auto *ft = llvm::FunctionType::get(builder->getDoubleTy(), fargs, false);
+    auto *ft = llvm::FunctionType::get(get_fp_type(), fargs, false);
     assert(ft != nullptr);
     // Now create the function.
     auto *f = llvm::Function::Create(ft, llvm::Function::ExternalLinkage, name, module.get());
     assert(f != nullptr);
     // Set names for all arguments.
-    decltype(vars.size()) idx = 0;
-    for (auto &arg : f->args()) {
-        arg.setName(vars[idx++]);
+    auto arg_it = f->arg_begin();
+    for (const auto &var : vars) {
+        (arg_it++)->setName(var);
     }
+    setup_param_arg(*f);
 
     // Create a new basic block to start insertion into.
     auto *bb = llvm::BasicBlock::Create(get_context(), "entry", f);
@@ -151,9 +485,12 @@ void llvm_state::add_varargs_expression(const std::string &name, const expressio
     builder->SetInsertPoint(bb);
 
     // Record the function arguments in the NamedValues map.
+    // NOTE: the array of the parameter values is not a variable.
     named_values.clear();
     for (auto &arg : f->args()) {
-        named_values[arg.getName()] = &arg;
+        if (&arg != param_values) {
+            named_values[arg.getName()] = &arg;
+        }
     }
 
     if (auto *ret_val = e.codegen(*this)) {
@@ -178,17 +515,19 @@ void llvm_state::add_vecargs_expression(const std::string &name, const std::vect
                                   + ", is too large");
     }
 
-    // Prepare the function prototype. The only argument is a pointer.
-    std::vector<llvm::Type *> fargs(1, llvm::PointerType::getUnqual(builder->getDoubleTy()));
+    // Prepare the function prototype. The only argument is a pointer
+    // (plus the array of the parameter values, if needed).
+    std::vector<llvm::Type *> fargs(1, llvm::PointerType::getUnqual(get_fp_type()));
+    add_param_arg(fargs);
     // Then the return type.
-    auto *ft = llvm::FunctionType::get(builder->getDoubleTy(), fargs, false);
+    auto *ft = llvm::FunctionType::get(get_fp_type(), fargs, false);
     assert(ft != nullptr);
     // Now create the function.
     auto *f = llvm::Function::Create(ft, llvm::Function::ExternalLinkage, name + ".vecargs", module.get());
     assert(f != nullptr);
     // Set the name of the function argument.
     const auto arg_rng = f->args();
-    assert(arg_rng.begin() != arg_rng.end() && arg_rng.begin() + 1 == arg_rng.end());
+    assert(arg_rng.begin() != arg_rng.end() && arg_rng.begin() + 1 + with_params == arg_rng.end());
     auto &vec_arg = *arg_rng.begin();
     vec_arg.setName("arg.vector");
     // Specify that this is a read-only pointer argument.
@@ -196,6 +535,7 @@ void llvm_state::add_vecargs_expression(const std::string &name, const std::vect
     // Specify that the function does not make any copies of the
     // pointer argument that outlive the function itself.
     vec_arg.addAttr(llvm::Attribute::NoCapture);
+    setup_param_arg(*f);
 
     // Create a new basic block to start insertion into.
     auto *bb = llvm::BasicBlock::Create(get_context(), "entry", f);
@@ -223,7 +563,7 @@ void llvm_state::add_vecargs_expression(const std::string &name, const std::vect
         // simplicity.
         auto ptr = builder->CreateConstInBoundsGEP1_32(
             // The underlying type for the array.
-            builder->getDoubleTy(),
+            get_fp_type(),
             // The array (that is, the pointer argument passed
             // to this function).
             &vec_arg,
@@ -234,7 +574,7 @@ void llvm_state::add_vecargs_expression(const std::string &name, const std::vect
 
         // Create a load instruction from the pointer
         // into a new variable.
-        named_values[var] = builder->CreateLoad(builder->getDoubleTy(), ptr, var);
+        named_values[var] = builder->CreateLoad(get_fp_type(), ptr, var);
     }
 
     // NOTE: the idea now is that instead of re-generating
@@ -244,14 +584,17 @@ void llvm_state::add_vecargs_expression(const std::string &name, const std::vect
     // Lookup the varargs function.
     auto varargs_f = module->getFunction(name);
     assert(varargs_f);
-    assert(varargs_f->arg_size() == vars.size());
+    assert(varargs_f->arg_size() == vars.size() + with_params);
 
     // Create the function arguments.
     std::vector<llvm::Value *> args_v;
-    args_v.reserve(vars.size());
+    args_v.reserve(vars.size() + 1u);
     for (const auto &var : vars) {
         args_v.push_back(named_values[var]);
     }
+    if (param_values != nullptr) {
+        args_v.push_back(param_values);
+    }
 
     // Do the invocation.
     if (auto *ret_val = builder->CreateCall(varargs_f, args_v, "calltmp")) {
@@ -278,7 +621,8 @@ void llvm_state::add_batch_expression(const std::string &name, const std::vector
     }
 
     // Prepare the function prototype. Two pointers, one out, one in.
-    std::vector<llvm::Type *> fargs(2, llvm::PointerType::getUnqual(builder->getDoubleTy()));
+    std::vector<llvm::Type *> fargs(2, llvm::PointerType::getUnqual(get_fp_type()));
+    add_param_arg(fargs);
 
     // Then the return type.
     auto *ft = llvm::FunctionType::get(builder->getVoidTy(), fargs, false);
@@ -290,7 +634,7 @@ void llvm_state::add_batch_expression(const std::string &name, const std::vector
 
     // Set the name of the function arguments.
     const auto arg_rng = f->args();
-    assert(arg_rng.begin() != arg_rng.end() && arg_rng.begin() + 2 == arg_rng.end());
+    assert(arg_rng.begin() != arg_rng.end() && arg_rng.begin() + 2 + with_params == arg_rng.end());
 
     // The output argument.
     auto out_arg = arg_rng.begin();
@@ -316,6 +660,9 @@ void llvm_state::add_batch_expression(const std::string &name, const std::vector
     // for this function.
     in_arg->addAttr(llvm::Attribute::NoAlias);
 
+    // The array of the parameter values, if needed.
+    setup_param_arg(*f);
+
     // Lookup the vector function.
     auto vec_f = module->getFunction(name + ".vecargs");
     assert(vec_f != nullptr);
@@ -351,7 +698,7 @@ void llvm_state::add_batch_expression(const std::string &name, const std::vector
     // The output pointer.
     auto out_ptr = builder->CreateInBoundsGEP(
         // The underlying type for the array.
-        builder->getDoubleTy(),
+        get_fp_type(),
         // The array (that is, the pointer argument passed
         // to this function).
         &*out_arg,
@@ -363,7 +710,7 @@ void llvm_state::add_batch_expression(const std::string &name, const std::vector
     // The input pointer.
     auto in_ptr = builder->CreateInBoundsGEP(
         // The underlying type for the array.
-        builder->getDoubleTy(),
+        get_fp_type(),
         // The array (that is, the pointer argument passed
         // to this function).
         &*in_arg,
@@ -374,7 +721,11 @@ void llvm_state::add_batch_expression(const std::string &name, const std::vector
         "in_ptr");
 
     // Invoke the vector function, and store the result in out_ptr.
-    auto vec_f_call = builder->CreateCall(vec_f, {in_ptr}, "calltmp");
+    std::vector<llvm::Value *> vec_args{in_ptr};
+    if (param_values != nullptr) {
+        vec_args.push_back(param_values);
+    }
+    auto vec_f_call = builder->CreateCall(vec_f, vec_args, "calltmp");
     vec_f_call->setTailCall(true);
     builder->CreateStore(vec_f_call, out_ptr);
 
@@ -406,49 +757,1557 @@ void llvm_state::add_batch_expression(const std::string &name, const std::vector
     verify_function(f);
 }
 
-void llvm_state::add_expression(const std::string &name, const expression &e, unsigned batch_size)
+// Add the batch function for the expression name reading
+// the input in SoA layout: the input array contains the values
+// of each variable for all the evaluations, ordered by variable.
+void llvm_state::add_batch_soa_expression(const std::string &name, const std::vector<std::string> &vars,
+                                          unsigned batch_size)
 {
-    detail::check_symbol_name(name);
+    // NOTE: the offsets of the variables in the input
+    // array must be representable in the unsigned range.
+    if (vars.size() > std::numeric_limits<unsigned>::max() / batch_size) {
+        throw std::overflow_error("The number of variables in an expression, " + std::to_string(vars.size())
+                                  + ", is too large for a batch size of " + std::to_string(batch_size));
+    }
 
-    if (module->getNamedValue(name) != nullptr) {
-        throw std::invalid_argument("The name '" + name + "' already exists in the module");
+    // Prepare the function prototype. Two pointers, one out, one in.
+    std::vector<llvm::Type *> fargs(2, llvm::PointerType::getUnqual(get_fp_type()));
+    add_param_arg(fargs);
+    auto *ft = llvm::FunctionType::get(builder->getVoidTy(), fargs, false);
+    assert(ft != nullptr);
+
+    auto *f = llvm::Function::Create(ft, llvm::Function::ExternalLinkage, name + ".batch_soa", module.get());
+    assert(f != nullptr);
+
+    // Set up the function arguments (same as in the AoS version).
+    const auto arg_rng = f->args();
+    assert(arg_rng.begin() != arg_rng.end() && arg_rng.begin() + 2 + with_params == arg_rng.end());
+
+    auto out_arg = arg_rng.begin();
+    out_arg->setName("batcharg.out");
+    out_arg->addAttr(llvm::Attribute::WriteOnly);
+    out_arg->addAttr(llvm::Attribute::NoCapture);
+    out_arg->addAttr(llvm::Attribute::NoAlias);
+
+    auto in_arg = out_arg + 1;
+    in_arg->setName("batcharg.in");
+    in_arg->addAttr(llvm::Attribute::ReadOnly);
+    in_arg->addAttr(llvm::Attribute::NoCapture);
+    in_arg->addAttr(llvm::Attribute::NoAlias);
+
+    setup_param_arg(*f);
+
+    // NOTE: in the SoA layout, the values of the variables are not
+    // contiguous, thus we invoke directly the varargs function.
+    auto varargs_f = module->getFunction(name);
+    assert(varargs_f != nullptr);
+    assert(varargs_f->arg_size() == vars.size() + with_params);
+
+    auto *bb = llvm::BasicBlock::Create(get_context(), "entry", f);
+    assert(bb != nullptr);
+    builder->SetInsertPoint(bb);
+
+    // The loop over the evaluations.
+    auto *preheader_bb = builder->GetInsertBlock();
+    auto *loop_bb = llvm::BasicBlock::Create(get_context(), "loop", f);
+    builder->CreateBr(loop_bb);
+    builder->SetInsertPoint(loop_bb);
+
+    auto *variable = builder->CreatePHI(builder->getInt32Ty(), 2, "i");
+    variable->addIncoming(builder->getInt32(0), preheader_bb);
+
+    // Load the value of each variable for the current evaluation
+    // from the block of the variable in the input array.
+    std::vector<llvm::Value *> args_v;
+    args_v.reserve(vars.size() + 1u);
+    for (decltype(vars.size()) j = 0; j < vars.size(); ++j) {
+        // NOTE: addition works regardless of integral signedness.
+        auto in_ptr = builder->CreateInBoundsGEP(
+            get_fp_type(), &*in_arg,
+            builder->CreateAdd(variable, builder->getInt32(static_cast<std::uint32_t>(j * batch_size)), "in_offset"),
+            "in_ptr_" + vars[j]);
+        args_v.push_back(builder->CreateLoad(get_fp_type(), in_ptr, vars[j]));
+    }
+    if (param_values != nullptr) {
+        args_v.push_back(param_values);
     }
 
-    // Fetch the number and names of the
-    // variables from the expression.
-    const auto vars = e.get_variables();
+    auto out_ptr = builder->CreateInBoundsGEP(get_fp_type(), &*out_arg, variable, "out_ptr");
 
-    add_varargs_expression(name, e, vars);
-    add_vecargs_expression(name, vars);
-    if (batch_size != 0u) {
-        add_batch_expression(name, vars, batch_size);
+    // Invoke the varargs function, and store the result in out_ptr.
+    auto varargs_f_call = builder->CreateCall(varargs_f, args_v, "calltmp");
+    varargs_f_call->setTailCall(true);
+    builder->CreateStore(varargs_f_call, out_ptr);
+
+    // Compute the next value of the iteration and the end condition.
+    auto *next_var = builder->CreateAdd(variable, builder->getInt32(1), "nextvar");
+    auto *end_cond = builder->CreateICmp(llvm::CmpInst::ICMP_ULT, next_var, builder->getInt32(batch_size), "loopcond");
+
+    auto *loop_end_bb = builder->GetInsertBlock();
+    auto *after_bb = llvm::BasicBlock::Create(get_context(), "afterloop", f);
+    builder->CreateCondBr(end_cond, loop_bb, after_bb);
+    builder->SetInsertPoint(after_bb);
+    variable->addIncoming(next_var, loop_end_bb);
+
+    builder->CreateRetVoid();
+
+    verify_function(f);
+}
+
+// Add the batch functions for the expression name reading the input
+// in place from existing buffers. If cols is false, the input is a single
+// array in which the values of the variables for the i-th evaluation start
+// at the offset i * in_stride (.batch_strided). Otherwise, the input is an
+// array of pointers to the columns of the variables, each with its own
+// stride (.batch_cols). In both cases, the output of the i-th evaluation is
+// written at the offset i * out_stride. The strides are in units of doubles.
+void llvm_state::add_batch_strided_expression(const std::string &name, const std::vector<std::string> &vars,
+                                              bool cols)
+{
+    auto *fp_t = llvm::PointerType::getUnqual(get_fp_type());
+
+    // Prepare the function prototype: the output pointer and stride,
+    // the input pointer(s) and stride(s), and the number of evaluations.
+    std::vector<llvm::Type *> fargs{fp_t, builder->getInt64Ty()};
+    if (cols) {
+        fargs.push_back(llvm::PointerType::getUnqual(fp_t));
+        fargs.push_back(llvm::PointerType::getUnqual(builder->getInt64Ty()));
+    } else {
+        fargs.push_back(fp_t);
+        fargs.push_back(builder->getInt64Ty());
     }
+    fargs.push_back(builder->getInt64Ty());
+    add_param_arg(fargs);
+    auto *ft = llvm::FunctionType::get(builder->getVoidTy(), fargs, false);
+    assert(ft != nullptr);
 
-    // Run the optimization pass.
-    if (opt_level > 0u) {
-        pm->run(*module);
+    auto *f = llvm::Function::Create(ft, llvm::Function::ExternalLinkage,
+                                     name + (cols ? ".batch_cols" : ".batch_strided"), module.get());
+    assert(f != nullptr);
+
+    auto arg_it = f->args().begin();
+
+    auto out_arg = arg_it++;
+    out_arg->setName("batcharg.out");
+    out_arg->addAttr(llvm::Attribute::WriteOnly);
+    out_arg->addAttr(llvm::Attribute::NoCapture);
+    out_arg->addAttr(llvm::Attribute::NoAlias);
+
+    auto out_stride_arg = arg_it++;
+    out_stride_arg->setName("batcharg.out_stride");
+
+    auto in_arg = arg_it++;
+    in_arg->setName("batcharg.in");
+    in_arg->addAttr(llvm::Attribute::ReadOnly);
+    in_arg->addAttr(llvm::Attribute::NoCapture);
+    // NOTE: the columns may overlap, thus the pointers
+    // to the columns cannot be marked as noalias.
+    if (!cols) {
+        in_arg->addAttr(llvm::Attribute::NoAlias);
+    }
+
+    auto in_stride_arg = arg_it++;
+    in_stride_arg->setName(cols ? "batcharg.in_strides" : "batcharg.in_stride");
+    if (cols) {
+        in_stride_arg->addAttr(llvm::Attribute::ReadOnly);
+        in_stride_arg->addAttr(llvm::Attribute::NoCapture);
+    }
+
+    auto n_arg = arg_it;
+    n_arg->setName("batcharg.n");
+
+    setup_param_arg(*f);
+
+    auto varargs_f = module->getFunction(name);
+    assert(varargs_f != nullptr);
+    assert(varargs_f->arg_size() == vars.size() + with_params);
+
+    auto *bb = llvm::BasicBlock::Create(get_context(), "entry", f);
+    assert(bb != nullptr);
+    builder->SetInsertPoint(bb);
+
+    // Fetch the base pointers and the strides of the
+    // variables before entering the loop.
+    std::vector<llvm::Value *> bases, strides;
+    for (decltype(vars.size()) j = 0; j < vars.size(); ++j) {
+        const auto j_val = builder->getInt64(static_cast<std::uint64_t>(j));
+        if (cols) {
+            bases.push_back(builder->CreateLoad(fp_t, builder->CreateInBoundsGEP(fp_t, &*in_arg, j_val),
+                                                "col_" + vars[j]));
+            strides.push_back(builder->CreateLoad(
+                builder->getInt64Ty(), builder->CreateInBoundsGEP(builder->getInt64Ty(), &*in_stride_arg, j_val),
+                "stride_" + vars[j]));
+        } else {
+            bases.push_back(builder->CreateInBoundsGEP(get_fp_type(), &*in_arg, j_val, "col_" + vars[j]));
+            strides.push_back(&*in_stride_arg);
+        }
+    }
+
+    auto *loop_bb = llvm::BasicBlock::Create(get_context(), "loop", f);
+    auto *after_bb = llvm::BasicBlock::Create(get_context(), "afterloop", f);
+
+    // NOTE: n could be zero, thus we need to
+    // check before entering the loop.
+    builder->CreateCondBr(builder->CreateICmpEQ(&*n_arg, builder->getInt64(0), "emptycond"), after_bb, loop_bb);
+
+    builder->SetInsertPoint(loop_bb);
+
+    auto *variable = builder->CreatePHI(builder->getInt64Ty(), 2, "i");
+    variable->addIncoming(builder->getInt64(0), bb);
+
+    // Load the values of the variables for the current evaluation.
+    std::vector<llvm::Value *> args_v;
+    args_v.reserve(vars.size() + 1u);
+    for (decltype(vars.size()) j = 0; j < vars.size(); ++j) {
+        auto in_ptr = builder->CreateInBoundsGEP(get_fp_type(), bases[j],
+                                                 builder->CreateMul(variable, strides[j]), "in_ptr_" + vars[j]);
+        args_v.push_back(builder->CreateLoad(get_fp_type(), in_ptr, vars[j]));
+    }
+    if (param_values != nullptr) {
+        args_v.push_back(param_values);
     }
+
+    auto out_ptr = builder->CreateInBoundsGEP(get_fp_type(), &*out_arg,
+                                              builder->CreateMul(variable, &*out_stride_arg), "out_ptr");
+
+    // Invoke the varargs function, and store the result in out_ptr.
+    auto varargs_f_call = builder->CreateCall(varargs_f, args_v, "calltmp");
+    varargs_f_call->setTailCall(true);
+    builder->CreateStore(varargs_f_call, out_ptr);
+
+    auto *next_var = builder->CreateAdd(variable, builder->getInt64(1), "nextvar");
+    auto *end_cond = builder->CreateICmp(llvm::CmpInst::ICMP_ULT, next_var, &*n_arg, "loopcond");
+
+    auto *loop_end_bb = builder->GetInsertBlock();
+    builder->CreateCondBr(end_cond, loop_bb, after_bb);
+    variable->addIncoming(next_var, loop_end_bb);
+
+    builder->SetInsertPoint(after_bb);
+    builder->CreateRetVoid();
+
+    verify_function(f);
 }
 
-void llvm_state::compile()
+// Add the loss kernel of type lt for the expression name. The kernel
+// evaluates the expression on the n points of the input array (in AoS
+// layout) and reduces the errors with respect to the target values,
+// without storing the values of the expression.
+// NOTE: the reduction of floating-point values cannot be vectorised
+// automatically (it would change the order of the operations), thus
+// we use explicitly a vector of partial accumulators. The width of
+// the vector is the SIMD width, if greater than 1. Otherwise, the
+// points are evaluated one at a time in groups of loss_acc_width.
+void llvm_state::add_loss_expression(const std::string &name, const expression &e,
+                                     const std::vector<std::string> &vars, loss_type lt)
 {
-    jitter.add_module(std::move(module));
+    auto *fp_t = get_fp_type();
+    auto *fp_ptr_t = llvm::PointerType::getUnqual(fp_t);
+
+    // Prepare the function prototype: the input and target
+    // pointers, and the number of evaluations.
+    std::vector<llvm::Type *> fargs{fp_ptr_t, fp_ptr_t, builder->getInt64Ty()};
+    add_param_arg(fargs);
+    auto *ft = llvm::FunctionType::get(fp_t, fargs, false);
+    assert(ft != nullptr);
+
+    auto *f = llvm::Function::Create(ft, llvm::Function::ExternalLinkage, name + detail::loss_suffix(lt),
+                                     module.get());
+    assert(f != nullptr);
+
+    auto arg_it = f->args().begin();
+
+    auto in_arg = arg_it++;
+    in_arg->setName("lossarg.in");
+    in_arg->addAttr(llvm::Attribute::ReadOnly);
+    in_arg->addAttr(llvm::Attribute::NoCapture);
+
+    auto target_arg = arg_it++;
+    target_arg->setName("lossarg.target");
+    target_arg->addAttr(llvm::Attribute::ReadOnly);
+    target_arg->addAttr(llvm::Attribute::NoCapture);
+
+    auto n_arg = arg_it;
+    n_arg->setName("lossarg.n");
+
+    setup_param_arg(*f);
+
+    auto varargs_f = module->getFunction(name);
+    assert(varargs_f != nullptr);
+    assert(varargs_f->arg_size() == vars.size() + with_params);
+
+    const auto width = simd_width > 1u ? simd_width : detail::loss_acc_width;
+    auto *vt = llvm::VectorType::get(fp_t, width);
+
+    // Evaluate the expression on the point i, via the varargs function.
+    auto eval_point = [&](llvm::Value *i) {
+        std::vector<llvm::Value *> args_v;
+        args_v.reserve(vars.size() + 1u);
+        for (decltype(vars.size()) j = 0; j < vars.size(); ++j) {
+            auto *offset = builder->CreateAdd(
+                builder->CreateMul(i, builder->getInt64(static_cast<std::uint64_t>(vars.size()))),
+                builder->getInt64(static_cast<std::uint64_t>(j)));
+            auto *in_ptr = builder->CreateInBoundsGEP(fp_t, &*in_arg, offset, "in_ptr_" + vars[j]);
+            args_v.push_back(builder->CreateLoad(fp_t, in_ptr, vars[j]));
+        }
+        if (param_values != nullptr) {
+            args_v.push_back(param_values);
+        }
+
+        auto *call = builder->CreateCall(varargs_f, args_v, "calltmp");
+        call->setTailCall(true);
+        return call;
+    };
+
+    // NOTE: the builder generates fast-math code, but the loss must propagate
+    // the NaN errors: with the nnan/ninf flags the NaN checks below would be
+    // folded away (and the selects turned into maxnum). Thus, the operations
+    // on the errors are generated with these two flags cleared.
+    auto loss_fmf = builder->getFastMathFlags();
+    loss_fmf.setNoNaNs(false);
+    loss_fmf.setNoInfs(false);
+
+    // The contribution to the loss of the error between vals and targets.
+    auto contribution = [&](llvm::Value *vals, llvm::Value *targets) -> llvm::Value * {
+        llvm::IRBuilder<>::FastMathFlagGuard fmf_guard(*builder);
+        builder->setFastMathFlags(loss_fmf);
+
+        auto *err = builder->CreateFSub(vals, targets);
+        if (lt == loss_type::sse) {
+            return builder->CreateFMul(err, err);
+        }
+        return builder->CreateUnaryIntrinsic(llvm::Intrinsic::fabs, err);
+    };
+
+    // Accumulate the contribution c into acc.
+    auto accumulate = [&](llvm::Value *acc, llvm::Value *c) -> llvm::Value * {
+        llvm::IRBuilder<>::FastMathFlagGuard fmf_guard(*builder);
+        builder->setFastMathFlags(loss_fmf);
+
+        if (lt != loss_type::max_abs) {
+            return builder->CreateFAdd(acc, c);
+        }
+        // NOTE: make sure that the NaNs are propagated.
+        auto *m = builder->CreateSelect(builder->CreateFCmpOGE(acc, c), acc, c);
+        return builder->CreateSelect(builder->CreateFCmpUNO(acc, acc), acc, m);
+    };
+
+    auto *bb = llvm::BasicBlock::Create(get_context(), "entry", f);
+    assert(bb != nullptr);
+    builder->SetInsertPoint(bb);
+
+    // The vectorised main loop, on the first n_vec points.
+    auto *n_vec = builder->CreateAnd(&*n_arg, builder->getInt64(~static_cast<std::uint64_t>(width - 1u)), "n_vec");
+    auto *zero_v = llvm::Constant::getNullValue(vt);
+
+    auto *vloop_bb = llvm::BasicBlock::Create(get_context(), "vloop", f);
+    auto *vafter_bb = llvm::BasicBlock::Create(get_context(), "vafterloop", f);
+    builder->CreateCondBr(builder->CreateICmpEQ(n_vec, builder->getInt64(0), "vemptycond"), vafter_bb, vloop_bb);
+
+    builder->SetInsertPoint(vloop_bb);
+    auto *vvariable = builder->CreatePHI(builder->getInt64Ty(), 2, "vi");
+    vvariable->addIncoming(builder->getInt64(0), bb);
+    auto *vacc = builder->CreatePHI(vt, 2, "vacc");
+    vacc->addIncoming(zero_v, bb);
+
+    llvm::Value *vals;
+    if (simd_width > 1u) {
+        vals = codegen_simd_points(e, vars, false, &*in_arg, &*n_arg, vvariable);
+        if (vals == nullptr) {
+            // Error in the codegen, remove the function.
+            f->eraseFromParent();
+            return;
+        }
+    } else {
+        vals = llvm::UndefValue::get(vt);
+        for (unsigned k = 0; k < width; ++k) {
+            vals = builder->CreateInsertElement(vals, eval_point(builder->CreateAdd(vvariable, builder->getInt64(k))),
+                                                k);
+        }
+    }
+
+    auto *target_ptr = builder->CreateInBoundsGEP(fp_t, &*target_arg, vvariable, "target_ptr");
+    auto *targets = builder->CreateLoad(vt, builder->CreateBitCast(target_ptr, llvm::PointerType::getUnqual(vt)));
+    // NOTE: the targets are aligned only to the floating-point type.
+    detail::set_alignment(targets, get_fp_align());
+
+    auto *new_vacc = accumulate(vacc, contribution(vals, targets));
+
+    auto *vnext_var = builder->CreateAdd(vvariable, builder->getInt64(width), "vnextvar");
+    auto *vloop_end_bb = builder->GetInsertBlock();
+    builder->CreateCondBr(builder->CreateICmp(llvm::CmpInst::ICMP_ULT, vnext_var, n_vec, "vloopcond"), vloop_bb,
+                          vafter_bb);
+    vvariable->addIncoming(vnext_var, vloop_end_bb);
+    vacc->addIncoming(new_vacc, vloop_end_bb);
+
+    // Reduce the partial accumulators.
+    builder->SetInsertPoint(vafter_bb);
+    auto *vacc_final = builder->CreatePHI(vt, 2, "vacc_final");
+    vacc_final->addIncoming(zero_v, bb);
+    vacc_final->addIncoming(new_vacc, vloop_end_bb);
+
+    auto *vres = builder->CreateExtractElement(vacc_final, std::uint64_t(0));
+    for (unsigned k = 1; k < width; ++k) {
+        vres = accumulate(vres, builder->CreateExtractElement(vacc_final, k));
+    }
+
+    // The scalar loop, on the remaining points.
+    auto *loop_bb = llvm::BasicBlock::Create(get_context(), "loop", f);
+    auto *after_bb = llvm::BasicBlock::Create(get_context(), "afterloop", f);
+    builder->CreateCondBr(builder->CreateICmpEQ(n_vec, &*n_arg, "emptycond"), after_bb, loop_bb);
+
+    builder->SetInsertPoint(loop_bb);
+    auto *variable = builder->CreatePHI(builder->getInt64Ty(), 2, "i");
+    variable->addIncoming(n_vec, vafter_bb);
+    auto *acc = builder->CreatePHI(fp_t, 2, "acc");
+    acc->addIncoming(vres, vafter_bb);
+
+    auto *target = builder->CreateLoad(fp_t, builder->CreateInBoundsGEP(fp_t, &*target_arg, variable), "target");
+    auto *new_acc = accumulate(acc, contribution(eval_point(variable), target));
+
+    auto *next_var = builder->CreateAdd(variable, builder->getInt64(1), "nextvar");
+    auto *loop_end_bb = builder->GetInsertBlock();
+    builder->CreateCondBr(builder->CreateICmp(llvm::CmpInst::ICMP_ULT, next_var, &*n_arg, "loopcond"), loop_bb,
+                          after_bb);
+    variable->addIncoming(next_var, loop_end_bb);
+    acc->addIncoming(new_acc, loop_end_bb);
+
+    builder->SetInsertPoint(after_bb);
+    auto *res = builder->CreatePHI(fp_t, 2, "res");
+    res->addIncoming(vres, vafter_bb);
+    res->addIncoming(new_acc, loop_end_bb);
+
+    if (lt == loss_type::mae) {
+        llvm::IRBuilder<>::FastMathFlagGuard fmf_guard(*builder);
+        builder->setFastMathFlags(loss_fmf);
+
+        // NOTE: the loss is zero if there are no points.
+        builder->CreateRet(builder->CreateSelect(builder->CreateICmpEQ(&*n_arg, builder->getInt64(0)),
+                                                 llvm::ConstantFP::get(fp_t, 0.),
+                                                 builder->CreateFDiv(res, builder->CreateUIToFP(&*n_arg, fp_t))));
+    } else {
+        builder->CreateRet(res);
+    }
+
+    verify_function(f);
 }
 
-std::uintptr_t llvm_state::jit_lookup(const std::string &name)
+// Emit the code evaluating e on the simd_width points starting from the
+// point i of the input array in_arg (in SoA layout with n_arg points if soa
+// is true, in AoS layout otherwise). Returns the vector of the values of e,
+// or null if the codegen of e failed.
+llvm::Value *llvm_state::codegen_simd_points(const expression &e, const std::vector<std::string> &vars, bool soa,
+                                             llvm::Value *in_arg, llvm::Value *n_arg, llvm::Value *i)
 {
-    auto sym = llvm::ExitOnError()(jitter.lookup(name));
-    return static_cast<std::uintptr_t>(sym.getAddress());
+    auto *vt = llvm::VectorType::get(get_fp_type(), simd_width);
+
+    // Load the values of the variables for the current points.
+    named_values.clear();
+    for (decltype(vars.size()) j = 0; j < vars.size(); ++j) {
+        const auto j_val = builder->getInt64(static_cast<std::uint64_t>(j));
+
+        if (soa) {
+            // NOTE: in SoA layout, the values are contiguous.
+            auto *in_ptr = builder->CreateInBoundsGEP(get_fp_type(), in_arg,
+                                                      builder->CreateAdd(builder->CreateMul(j_val, n_arg), i),
+                                                      "in_ptr_" + vars[j]);
+            auto *ld = builder->CreateLoad(vt, builder->CreateBitCast(in_ptr, llvm::PointerType::getUnqual(vt)),
+                                           vars[j]);
+            // NOTE: the input is aligned only to the floating-point type.
+            detail::set_alignment(ld, get_fp_align());
+            named_values[vars[j]] = ld;
+        } else {
+            llvm::Value *vec = llvm::UndefValue::get(vt);
+            for (unsigned k = 0; k < simd_width; ++k) {
+                auto *offset = builder->CreateAdd(
+                    builder->CreateMul(builder->CreateAdd(i, builder->getInt64(k)),
+                                       builder->getInt64(static_cast<std::uint64_t>(vars.size()))),
+                    j_val);
+                auto *in_ptr = builder->CreateInBoundsGEP(get_fp_type(), in_arg, offset);
+                vec = builder->CreateInsertElement(vec, builder->CreateLoad(get_fp_type(), in_ptr), k);
+            }
+            named_values[vars[j]] = vec;
+        }
+    }
+
+    // Generate the vector code for the expression.
+    cg_width = simd_width;
+    llvm::Value *ret_val;
+    try {
+        ret_val = e.codegen(*this);
+    } catch (...) {
+        cg_width = 1;
+        throw;
+    }
+    cg_width = 1;
+
+    return ret_val;
 }
 
-llvm_state::f_ptr llvm_state::fetch(const std::string &name)
+// The alignment of the floating-point type
+// of the functions being generated.
+unsigned llvm_state::get_fp_align() const
 {
-    return reinterpret_cast<f_ptr>(jit_lookup(name + ".vecargs"));
+    return single_precision ? alignof(float) : alignof(double);
 }
 
-llvm_state::f_batch_ptr llvm_state::fetch_batch(const std::string &name)
+// Append the array of the parameter values to the
+// arguments fargs of a function being generated,
+// if the function takes the parameter values.
+void llvm_state::add_param_arg(std::vector<llvm::Type *> &fargs)
 {
-    return reinterpret_cast<f_batch_ptr>(jit_lookup(name + ".batch"));
+    if (with_params) {
+        fargs.push_back(llvm::PointerType::getUnqual(get_fp_type()));
+    }
+}
+
+// Set up the last argument of the function f as the array of
+// the parameter values (if the function takes the parameter
+// values), and make it available to the codegen of the
+// parameters. Returns the array (null if none).
+llvm::Value *llvm_state::setup_param_arg(llvm::Function &f)
+{
+    if (!with_params) {
+        return param_values = nullptr;
+    }
+
+    assert(f.arg_size() > 0u);
+    auto *arg = f.arg_begin() + (f.arg_size() - 1u);
+    arg->setName("pars");
+    arg->addAttr(llvm::Attribute::ReadOnly);
+    arg->addAttr(llvm::Attribute::NoCapture);
+    arg->addAttr(llvm::Attribute::NoAlias);
+
+    return param_values = arg;
+}
+
+// Add the batch function for the expression name taking
+// the number of evaluations as a runtime argument. The input
+// is in SoA layout if soa is true, in AoS layout otherwise.
+// NOTE: the trip count of the loop is not known at compile time, thus
+// the loop vectorizer will generate a vectorized main loop followed
+// by a scalar loop for the remainder. If the SIMD width is greater
+// than 1, we generate the vectorized main loop ourselves instead.
+void llvm_state::add_batch_n_expression(const std::string &name, const expression &e,
+                                        const std::vector<std::string> &vars, bool soa)
+{
+    // Prepare the function prototype: the two
+    // pointers, and the number of evaluations.
+    std::vector<llvm::Type *> fargs(2, llvm::PointerType::getUnqual(get_fp_type()));
+    fargs.push_back(builder->getInt64Ty());
+    add_param_arg(fargs);
+    auto *ft = llvm::FunctionType::get(builder->getVoidTy(), fargs, false);
+    assert(ft != nullptr);
+
+    auto *f = llvm::Function::Create(ft, llvm::Function::ExternalLinkage,
+                                     name + (soa ? ".batch_soa_n" : ".batch_n"), module.get());
+    assert(f != nullptr);
+
+    // Set up the function arguments (same as in the other batch functions).
+    auto arg_it = f->args().begin();
+
+    auto out_arg = arg_it++;
+    out_arg->setName("batcharg.out");
+    out_arg->addAttr(llvm::Attribute::WriteOnly);
+    out_arg->addAttr(llvm::Attribute::NoCapture);
+    out_arg->addAttr(llvm::Attribute::NoAlias);
+
+    auto in_arg = arg_it++;
+    in_arg->setName("batcharg.in");
+    in_arg->addAttr(llvm::Attribute::ReadOnly);
+    in_arg->addAttr(llvm::Attribute::NoCapture);
+    in_arg->addAttr(llvm::Attribute::NoAlias);
+
+    auto n_arg = arg_it;
+    n_arg->setName("batcharg.n");
+
+    setup_param_arg(*f);
+
+    auto varargs_f = module->getFunction(name);
+    assert(varargs_f != nullptr);
+    assert(varargs_f->arg_size() == vars.size() + with_params);
+
+    auto *bb = llvm::BasicBlock::Create(get_context(), "entry", f);
+    assert(bb != nullptr);
+    builder->SetInsertPoint(bb);
+
+    // The first point evaluated by the scalar loop, and
+    // the block from which the scalar loop is entered.
+    llvm::Value *start_val = builder->getInt64(0);
+    auto *pre_bb = bb;
+
+    if (simd_width > 1u) {
+        // Evaluate the points in chunks of simd_width. The
+        // remaining points are evaluated by the scalar loop.
+        start_val = builder->CreateAnd(&*n_arg, builder->getInt64(~static_cast<std::uint64_t>(simd_width - 1u)),
+                                       "n_vec");
+
+        auto *vloop_bb = llvm::BasicBlock::Create(get_context(), "vloop", f);
+        pre_bb = llvm::BasicBlock::Create(get_context(), "vafterloop", f);
+        builder->CreateCondBr(builder->CreateICmpEQ(start_val, builder->getInt64(0), "vemptycond"), pre_bb, vloop_bb);
+
+        builder->SetInsertPoint(vloop_bb);
+        auto *vvariable = builder->CreatePHI(builder->getInt64Ty(), 2, "vi");
+        vvariable->addIncoming(builder->getInt64(0), bb);
+
+        auto *ret_val = codegen_simd_points(e, vars, soa, &*in_arg, &*n_arg, vvariable);
+        if (ret_val == nullptr) {
+            // Error in the codegen, remove the function.
+            f->eraseFromParent();
+            return;
+        }
+
+        auto *out_ptr = builder->CreateInBoundsGEP(get_fp_type(), &*out_arg, vvariable, "out_ptr");
+        auto *st = builder->CreateStore(
+            ret_val, builder->CreateBitCast(out_ptr, llvm::PointerType::getUnqual(ret_val->getType())));
+        // NOTE: the output is aligned only to the floating-point type.
+        detail::set_alignment(st, get_fp_align());
+
+        auto *vnext_var = builder->CreateAdd(vvariable, builder->getInt64(simd_width), "vnextvar");
+        auto *vloop_end_bb = builder->GetInsertBlock();
+        builder->CreateCondBr(builder->CreateICmp(llvm::CmpInst::ICMP_ULT, vnext_var, start_val, "vloopcond"),
+                              vloop_bb, pre_bb);
+        vvariable->addIncoming(vnext_var, vloop_end_bb);
+
+        builder->SetInsertPoint(pre_bb);
+    }
+
+    auto *loop_bb = llvm::BasicBlock::Create(get_context(), "loop", f);
+    auto *after_bb = llvm::BasicBlock::Create(get_context(), "afterloop", f);
+
+    // NOTE: there could be no points left for the scalar
+    // loop, thus we need to check before entering the loop.
+    builder->CreateCondBr(builder->CreateICmpEQ(start_val, &*n_arg, "emptycond"), after_bb, loop_bb);
+
+    builder->SetInsertPoint(loop_bb);
+
+    auto *variable = builder->CreatePHI(builder->getInt64Ty(), 2, "i");
+    variable->addIncoming(start_val, pre_bb);
+
+    // Load the values of the variables for the current evaluation.
+    // NOTE: the arithmetic works regardless of integral signedness.
+    std::vector<llvm::Value *> args_v;
+    args_v.reserve(vars.size() + 1u);
+    for (decltype(vars.size()) j = 0; j < vars.size(); ++j) {
+        const auto j_val = builder->getInt64(static_cast<std::uint64_t>(j));
+        auto *offset = soa ? builder->CreateAdd(builder->CreateMul(j_val, &*n_arg), variable, "in_offset")
+                           : builder->CreateAdd(
+                               builder->CreateMul(variable, builder->getInt64(static_cast<std::uint64_t>(vars.size()))),
+                               j_val, "in_offset");
+        auto in_ptr = builder->CreateInBoundsGEP(get_fp_type(), &*in_arg, offset, "in_ptr_" + vars[j]);
+        args_v.push_back(builder->CreateLoad(get_fp_type(), in_ptr, vars[j]));
+    }
+    if (param_values != nullptr) {
+        args_v.push_back(param_values);
+    }
+
+    auto out_ptr = builder->CreateInBoundsGEP(get_fp_type(), &*out_arg, variable, "out_ptr");
+
+    // Invoke the varargs function, and store the result in out_ptr.
+    auto varargs_f_call = builder->CreateCall(varargs_f, args_v, "calltmp");
+    varargs_f_call->setTailCall(true);
+    builder->CreateStore(varargs_f_call, out_ptr);
+
+    auto *next_var = builder->CreateAdd(variable, builder->getInt64(1), "nextvar");
+    auto *end_cond = builder->CreateICmp(llvm::CmpInst::ICMP_ULT, next_var, &*n_arg, "loopcond");
+
+    auto *loop_end_bb = builder->GetInsertBlock();
+    builder->CreateCondBr(end_cond, loop_bb, after_bb);
+    variable->addIncoming(next_var, loop_end_bb);
+
+    builder->SetInsertPoint(after_bb);
+    builder->CreateRetVoid();
+
+    verify_function(f);
+}
+
+void llvm_state::add_expression(const std::string &name, const expression &e, unsigned batch_size,
+                                unsigned long long n_calls)
+{
+    // NOTE: this includes the time spent in optimize_function(),
+    // which is subtracted in compile().
+    detail::scoped_timer timer{cur_stats.ir_build};
+
+    detail::check_symbol_name(name);
+
+    check_name_availability(name);
+
+    // Fetch the number and names of the
+    // variables from the expression.
+    const auto vars = e.get_variables();
+
+    // NOTE: if the expression contains parameters, all
+    // the functions take the parameter values as last argument.
+    with_params = e.get_n_params() != 0u;
+    if (with_params && single_precision) {
+        throw std::invalid_argument("Cannot add the expression '" + name
+                                    + "': parameters are available only in double precision");
+    }
+
+    const auto pl_level = select_pipeline_level(e, n_calls);
+    const auto pl_name = pl_level ? detail::auto_pipeline_name(*pl_level) : get_opt_pipeline();
+
+    // Check if an identical expression was already added.
+    const auto h = detail::dedup_hash(e);
+    if (add_duplicate(name, e, batch_size, pl_name, h)) {
+        register_n_vars(name, vars.size());
+        return;
+    }
+
+    // NOTE: the automatic pipeline is created (and reported)
+    // only if new code is generated for the expression.
+    auto *pl = fn_pl.get();
+    if (pl_level) {
+        if (!auto_pls[*pl_level]) {
+            auto_pls[*pl_level] = std::make_unique<detail::fn_pipeline>(*tm, pl_name);
+        }
+        pl = auto_pls[*pl_level].get();
+
+        if (verbose) {
+            std::clog << "Optimisation pipeline for the expression '" << name << "' (" << n_calls
+                      << " expected calls): " << pl_name << std::endl;
+        }
+    }
+
+    add_varargs_expression(name, e, vars);
+    add_vecargs_expression(name, vars);
+    if (batch_size != 0u) {
+        add_batch_expression(name, vars, batch_size);
+        if (batch_soa) {
+            add_batch_soa_expression(name, vars, batch_size);
+        }
+    }
+    add_batch_n_expression(name, e, vars, false);
+    if (batch_soa) {
+        add_batch_n_expression(name, e, vars, true);
+    }
+    if (batch_strided) {
+        add_batch_strided_expression(name, vars, false);
+        add_batch_strided_expression(name, vars, true);
+    }
+    if (loss_kernels) {
+        for (const auto lt : {loss_type::sse, loss_type::mae, loss_type::max_abs}) {
+            add_loss_expression(name, e, vars, lt);
+        }
+    }
+
+    // Run the function-level optimisation passes
+    // on the newly-added functions only.
+    for (const auto &fname : {name, name + ".vecargs"}) {
+        if (auto f = module->getFunction(fname)) {
+            optimize_function(*f, pl);
+        }
+    }
+    for (const auto *batch_suffix : detail::batch_suffixes) {
+        if (auto f = module->getFunction(name + batch_suffix)) {
+            optimize_function(*f, pl);
+        }
+    }
+
+    if (batch_multiversioning) {
+        add_batch_variants(name, pl);
+    }
+
+    // Record the expression for deduplication.
+    auto de = std::make_unique<dedup_entry>(
+        dedup_entry{h, e, batch_size, batch_soa, batch_strided, single_precision, loss_kernels,
+                    batch_multiversioning, simd_width, target_cpu, target_features, with_params,
+                    pl_name, name, std::nullopt, nullptr});
+    module_entries.push_back(de.get());
+    dedup_map.emplace(h, std::move(de));
+
+    register_n_vars(name, vars.size());
+}
+
+// Record the number of variables of the expression name
+// for the parallel evaluation.
+// NOTE: the parallel evaluation is available only in double
+// precision, and for the expressions without parameters.
+void llvm_state::register_n_vars(const std::string &name, std::size_t n)
+{
+    if (single_precision || with_params) {
+        expression_n_vars.erase(name);
+    } else {
+        expression_n_vars[name] = n;
+    }
+}
+
+void llvm_state::add_expressions(const std::string &name, const std::vector<expression> &exs, unsigned batch_size)
+{
+    detail::scoped_timer timer{cur_stats.ir_build};
+
+    detail::check_symbol_name(name);
+
+    check_name_availability(name);
+
+    if (exs.empty()) {
+        throw std::invalid_argument("Cannot add the function '" + name + "': the vector of expressions is empty");
+    }
+
+    if (std::any_of(exs.begin(), exs.end(), [](const expression &e) { return e.get_n_params() != 0u; })) {
+        throw std::invalid_argument("Cannot add the function '" + name
+                                    + "': parameters are not supported in fused kernels");
+    }
+    with_params = false;
+
+    // NOTE: the parallel evaluation does not support fused kernels, make
+    // sure we do not keep the data of a released expression with the same name.
+    expression_n_vars.erase(name);
+
+    // The variables of all the expressions, in alphabetical order.
+    std::vector<std::string> vars;
+    for (const auto &e : exs) {
+        const auto e_vars = e.get_variables();
+        vars.insert(vars.end(), e_vars.begin(), e_vars.end());
+    }
+    std::sort(vars.begin(), vars.end());
+    vars.erase(std::unique(vars.begin(), vars.end()), vars.end());
+
+    add_multi_expression(name, exs, vars);
+    if (batch_size != 0u) {
+        add_multi_batch_expression(name, vars.size(), exs.size(), batch_size);
+    }
+    add_multi_batch_expression(name, vars.size(), exs.size(), 0);
+
+    for (const auto &fname : {name, name + ".batch", name + ".batch_n"}) {
+        if (auto f = module->getFunction(fname)) {
+            optimize_function(*f);
+        }
+    }
+
+    if (batch_multiversioning) {
+        add_batch_variants(name, fn_pl.get());
+    }
+}
+
+// Add the fused kernel for the expressions exs, which writes
+// the value of the i-th expression into the i-th element of
+// the output array. The variables are read from the input array,
+// in the order given by vars.
+void llvm_state::add_multi_expression(const std::string &name, const std::vector<expression> &exs,
+                                      const std::vector<std::string> &vars)
+{
+    // NOTE: we support indices within the unsigned range below.
+    if (vars.size() > std::numeric_limits<unsigned>::max()) {
+        throw std::overflow_error("The number of variables in a vector of expressions, "
+                                  + std::to_string(vars.size()) + ", is too large");
+    }
+    if (exs.size() > std::numeric_limits<unsigned>::max()) {
+        throw std::overflow_error("The number of expressions in a vector of expressions, "
+                                  + std::to_string(exs.size()) + ", is too large");
+    }
+
+    // Prepare the function prototype: the output
+    // and the input pointers.
+    std::vector<llvm::Type *> fargs(2, llvm::PointerType::getUnqual(get_fp_type()));
+    auto *ft = llvm::FunctionType::get(builder->getVoidTy(), fargs, false);
+    assert(ft != nullptr);
+
+    auto *f = llvm::Function::Create(ft, llvm::Function::ExternalLinkage, name, module.get());
+    assert(f != nullptr);
+
+    auto arg_it = f->args().begin();
+
+    auto out_arg = arg_it++;
+    out_arg->setName("multiarg.out");
+    out_arg->addAttr(llvm::Attribute::WriteOnly);
+    out_arg->addAttr(llvm::Attribute::NoCapture);
+    out_arg->addAttr(llvm::Attribute::NoAlias);
+
+    auto in_arg = arg_it;
+    in_arg->setName("multiarg.in");
+    in_arg->addAttr(llvm::Attribute::ReadOnly);
+    in_arg->addAttr(llvm::Attribute::NoCapture);
+    in_arg->addAttr(llvm::Attribute::NoAlias);
+
+    auto *bb = llvm::BasicBlock::Create(get_context(), "entry", f);
+    assert(bb != nullptr);
+    builder->SetInsertPoint(bb);
+
+    // Load the variables once, for all the expressions.
+    named_values.clear();
+    for (decltype(vars.size()) i = 0; i < vars.size(); ++i) {
+        auto ptr
+            = builder->CreateConstInBoundsGEP1_32(get_fp_type(), &*in_arg, static_cast<unsigned>(i),
+                                                  "ptr_" + vars[i]);
+        named_values[vars[i]] = builder->CreateLoad(get_fp_type(), ptr, vars[i]);
+    }
+
+    // NOTE: the code for all the expressions is generated in the same
+    // function, so that the optimiser can share the common
+    // subexpressions among the outputs.
+    for (decltype(exs.size()) i = 0; i < exs.size(); ++i) {
+        auto *ret_val = exs[i].codegen(*this);
+        if (ret_val == nullptr) {
+            // Error in the codegen, remove the function.
+            f->eraseFromParent();
+            return;
+        }
+
+        auto ptr = builder->CreateConstInBoundsGEP1_32(get_fp_type(), &*out_arg, static_cast<unsigned>(i),
+                                                       "out_ptr");
+        builder->CreateStore(ret_val, ptr);
+    }
+
+    builder->CreateRetVoid();
+
+    verify_function(f);
+}
+
+// Add the batch function for the fused kernel name, with nvars
+// inputs and nout outputs. The function evaluates the kernel on
+// batch_size points or, if batch_size is zero, on a number of points
+// passed as a runtime argument. The input and the output are both in
+// AoS layout.
+void llvm_state::add_multi_batch_expression(const std::string &name, std::uint64_t nvars, std::uint64_t nout,
+                                            unsigned batch_size)
+{
+    // Prepare the function prototype: the two pointers and,
+    // for the runtime-length version, the number of evaluations.
+    std::vector<llvm::Type *> fargs(2, llvm::PointerType::getUnqual(get_fp_type()));
+    if (batch_size == 0u) {
+        fargs.push_back(builder->getInt64Ty());
+    }
+    auto *ft = llvm::FunctionType::get(builder->getVoidTy(), fargs, false);
+    assert(ft != nullptr);
+
+    auto *f = llvm::Function::Create(ft, llvm::Function::ExternalLinkage,
+                                     name + (batch_size == 0u ? ".batch_n" : ".batch"), module.get());
+    assert(f != nullptr);
+
+    auto arg_it = f->args().begin();
+
+    auto out_arg = arg_it++;
+    out_arg->setName("batcharg.out");
+    out_arg->addAttr(llvm::Attribute::WriteOnly);
+    out_arg->addAttr(llvm::Attribute::NoCapture);
+    out_arg->addAttr(llvm::Attribute::NoAlias);
+
+    auto in_arg = arg_it++;
+    in_arg->setName("batcharg.in");
+    in_arg->addAttr(llvm::Attribute::ReadOnly);
+    in_arg->addAttr(llvm::Attribute::NoCapture);
+    in_arg->addAttr(llvm::Attribute::NoAlias);
+
+    llvm::Value *n_val;
+    if (batch_size == 0u) {
+        arg_it->setName("batcharg.n");
+        n_val = &*arg_it;
+    } else {
+        n_val = builder->getInt64(batch_size);
+    }
+
+    auto kernel_f = module->getFunction(name);
+    assert(kernel_f != nullptr);
+
+    auto *bb = llvm::BasicBlock::Create(get_context(), "entry", f);
+    assert(bb != nullptr);
+    builder->SetInsertPoint(bb);
+
+    auto *loop_bb = llvm::BasicBlock::Create(get_context(), "loop", f);
+    auto *after_bb = llvm::BasicBlock::Create(get_context(), "afterloop", f);
+
+    // NOTE: n could be zero, thus we need to
+    // check before entering the loop.
+    builder->CreateCondBr(builder->CreateICmpEQ(n_val, builder->getInt64(0), "emptycond"), after_bb, loop_bb);
+
+    builder->SetInsertPoint(loop_bb);
+
+    auto *variable = builder->CreatePHI(builder->getInt64Ty(), 2, "i");
+    variable->addIncoming(builder->getInt64(0), bb);
+
+    // Invoke the kernel on the input and the output of the current point.
+    auto in_ptr = builder->CreateInBoundsGEP(get_fp_type(), &*in_arg,
+                                             builder->CreateMul(variable, builder->getInt64(nvars)), "in_ptr");
+    auto out_ptr = builder->CreateInBoundsGEP(get_fp_type(), &*out_arg,
+                                              builder->CreateMul(variable, builder->getInt64(nout)), "out_ptr");
+    auto kernel_call = builder->CreateCall(kernel_f, {out_ptr, in_ptr});
+    kernel_call->setTailCall(true);
+
+    auto *next_var = builder->CreateAdd(variable, builder->getInt64(1), "nextvar");
+    auto *end_cond = builder->CreateICmp(llvm::CmpInst::ICMP_ULT, next_var, n_val, "loopcond");
+
+    auto *loop_end_bb = builder->GetInsertBlock();
+    builder->CreateCondBr(end_cond, loop_bb, after_bb);
+    variable->addIncoming(next_var, loop_end_bb);
+
+    builder->SetInsertPoint(after_bb);
+    builder->CreateRetVoid();
+
+    verify_function(f);
+}
+
+// If an expression identical to e (with the same batch size, code generation
+// settings and optimisation pipeline pl_name) was already added to the state,
+// make name an alias of it and return true. h is the hash of e.
+bool llvm_state::add_duplicate(const std::string &name, const expression &e, unsigned batch_size,
+                               const std::string &pl_name, std::size_t h)
+{
+    for (auto [it, end] = dedup_map.equal_range(h); it != end; ++it) {
+        auto &de = *it->second;
+        if (de.batch_size != batch_size || de.batch_soa != batch_soa || de.batch_strided != batch_strided
+            || de.single_precision != single_precision || de.loss_kernels != loss_kernels
+            || de.batch_multiversioning != batch_multiversioning || de.simd_width != simd_width
+            || de.target_cpu != target_cpu || de.target_features != target_features || de.with_params != with_params
+            || de.pipeline != pl_name || !detail::dedup_equal(de.ex, e)) {
+            continue;
+        }
+
+        if (auto au = de.async) {
+            std::lock_guard lock{au->mutex};
+
+            if (!au->done) {
+                // NOTE: the module of the expression is still being
+                // compiled, thus the aliases will be defined by the
+                // compiling thread.
+                for (const auto &suffix : detail::alias_suffixes()) {
+                    const auto t_name = de.name + suffix;
+                    if (au->names.find(t_name) != au->names.end()) {
+                        au->aliases.emplace_back(name + suffix, t_name);
+                        au->names.insert(name + suffix);
+                    }
+                }
+                return true;
+            }
+
+            // NOTE: skip the expressions whose compilation failed.
+            if (!au->unit) {
+                continue;
+            }
+            de.unit = au->unit;
+            de.async.reset();
+        }
+
+        // NOTE: skip the expressions whose unit has been released
+        // (possibly by a sibling state).
+        if (!de.unit || jitter->has_unit(*de.unit)) {
+            add_aliases(name, de.name);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Make name an alias of the expression target, that is, make
+// the functions generated for name aliases of the functions
+// generated for target.
+void llvm_state::add_aliases(const std::string &name, const std::string &target)
+{
+    for (const auto &suffix : detail::alias_suffixes()) {
+        const auto t_name = target + suffix;
+        if (module->getFunction(t_name) != nullptr) {
+            // NOTE: the functions in the current module can be
+            // aliased in the JIT only after they are compiled.
+            pending_aliases.emplace_back(name + suffix, t_name);
+        } else if (jitter->has_symbol(t_name)) {
+            jitter->add_alias(name + suffix, t_name);
+        }
+    }
+}
+
+// Select the level of the automatic function-level pipeline for the
+// expression e, given the expected number of calls n_calls. An empty
+// return value selects the pipeline of the state.
+std::optional<std::size_t> llvm_state::select_pipeline_level(const expression &e, unsigned long long n_calls) const
+{
+    // NOTE: a pipeline explicitly selected by the user overrides
+    // the automatic selection. At opt level 0, no optimisation
+    // is run unless explicitly requested by the user.
+    if (fn_pl || n_calls == 0u || opt_level == 0u) {
+        return {};
+    }
+
+    // NOTE: the time saved by the optimiser at each evaluation grows with
+    // the size of the expression, while the time spent in the optimiser (and
+    // in the codegen) is dominated by a per-function cost for the expressions
+    // of typical size. Thus, we base the selection on the estimated total
+    // evaluation work (i.e., the number of calls times the number of nodes),
+    // measured against thresholds increasing with the cost of each level.
+    // The level is capped at the opt level of the state.
+    const auto n_nodes = e.compute_connections().size();
+    const auto work = static_cast<double>(n_calls) * static_cast<double>(n_nodes);
+
+    std::size_t l;
+    if (work < 1E4) {
+        l = 0;
+    } else if (work < 1E6) {
+        l = 1;
+    } else if (work < 1E8) {
+        l = 2;
+    } else {
+        l = 3;
+    }
+
+    return std::min(l, static_cast<std::size_t>(opt_level));
+}
+
+// Add the multiversioned variants of the batch functions
+// for the expression name.
+void llvm_state::add_batch_variants(const std::string &name, detail::fn_pipeline *pl)
+{
+    for (const auto *batch_suffix : detail::batch_suffixes) {
+        if (auto *batch_f = module->getFunction(name + batch_suffix)) {
+            add_batch_variants(*batch_f, pl);
+        }
+    }
+}
+
+// Add the multiversioned variants of the batch function batch_f.
+void llvm_state::add_batch_variants(llvm::Function &batch_f, detail::fn_pipeline *pl)
+{
+    for (const auto &bv : detail::batch_variants) {
+        llvm::ValueToValueMapTy vmap;
+        std::vector<llvm::Function *> clones;
+        detail::clone_call_tree(batch_f, bv.suffix, vmap, clones);
+
+        for (auto *f : clones) {
+            f->addFnAttr("target-cpu", bv.cpu);
+            f->addFnAttr("target-features", bv.features);
+            f->addFnAttr("prefer-vector-width", bv.vector_width);
+            f->addFnAttr("min-legal-vector-width", bv.vector_width);
+
+            optimize_function(*f, pl);
+        }
+    }
+}
+
+// Set the target CPU and features selected by the user
+// on the function f, unless they are already set.
+void llvm_state::set_target_attributes(llvm::Function &f) const
+{
+    if (!target_cpu.empty() && !f.hasFnAttribute("target-cpu")) {
+        f.addFnAttr("target-cpu", target_cpu);
+    }
+    if (!target_features.empty() && !f.hasFnAttribute("target-features")) {
+        f.addFnAttr("target-features", target_features);
+    }
+}
+
+// Run the function pass manager (or the pipeline selected
+// by the user) on f. The module-level optimisation passes
+// (which, e.g., take care of inlining) are run only once
+// on the whole module in compile().
+void llvm_state::optimize_function(llvm::Function &f)
+{
+    optimize_function(f, fn_pl.get());
+}
+
+// Run the pipeline pl on f. If pl is null, the
+// function pass manager is used instead.
+void llvm_state::optimize_function(llvm::Function &f, detail::fn_pipeline *pl)
+{
+    set_target_attributes(f);
+
+    if (pl != nullptr) {
+        detail::scoped_timer timer{cur_stats.fn_opt};
+        pl->run(f);
+    } else if (opt_level > 0u) {
+        detail::scoped_timer timer{cur_stats.fn_opt};
+        fpm->run(f);
+    }
+}
+
+// Fetch the function called name from the current module,
+// resolving the aliases created by the deduplication.
+// Returns null if the function does not exist.
+llvm::Function *llvm_state::get_function(const std::string &name) const
+{
+    for (const auto &[alias, target] : pending_aliases) {
+        if (alias == name) {
+            return module->getFunction(target);
+        }
+    }
+
+    return module->getFunction(name);
+}
+
+// Check that name can be used for the definition
+// of a new function, either in the current module or in
+// the modules which were already compiled.
+void llvm_state::check_name_availability(const std::string &name) const
+{
+    if (module->getNamedValue(name) != nullptr) {
+        throw std::invalid_argument("The name '" + name + "' already exists in the module");
+    }
+
+    if (std::any_of(pending_aliases.begin(), pending_aliases.end(),
+                    [&name](const auto &p) { return p.first == name; })) {
+        throw std::invalid_argument("The name '" + name + "' already exists in the module");
+    }
+
+    if (jitter->has_symbol(name)) {
+        throw std::invalid_argument("The name '" + name + "' already exists in a compiled module");
+    }
+
+    for (const auto &au : async_units) {
+        std::lock_guard lock{au->mutex};
+
+        if (!au->done && au->names.find(name) != au->names.end()) {
+            throw std::invalid_argument("The name '" + name + "' already exists in a module being compiled");
+        }
+    }
+}
+
+llvm_state::unit_id llvm_state::compile()
+{
+    // Run the module-level optimisation passes.
+    // NOTE: this is done only here (rather than in add_expression()
+    // and add_taylor()) so that the cost of the module-level
+    // optimisation does not grow quadratically with
+    // the number of functions in the module.
+    // NOTE: before that, make sure that all the functions have the
+    // target attributes (including the helpers which do not go
+    // through optimize_function()), otherwise the inliner
+    // could refuse to inline them.
+    for (auto &f : *module) {
+        if (!f.isDeclaration()) {
+            set_target_attributes(f);
+        }
+    }
+    if (opt_level > 0u) {
+        detail::scoped_timer timer{cur_stats.module_opt};
+        detail::run_module_pm(*pm, *module);
+    }
+
+    // NOTE: hand over the current module to the JIT,
+    // and start afresh with a new empty module. This allows
+    // to keep on adding expressions to the state after
+    // compilation, re-using the same JIT session.
+    // NOTE: the aliases to the functions in the module are defined
+    // together with the module, so that an error (e.g., an alias name
+    // defined in the meantime by a sibling state) leaves no unit behind.
+    unit_id retval;
+    try {
+        retval = jitter->add_module(ctx, std::move(module), compile_threads, pending_aliases);
+    } catch (...) {
+        // NOTE: the module has been handed over to the JIT, thus
+        // we discard its expressions and start afresh with a new
+        // module, so that the state remains usable.
+        for (auto *de : module_entries) {
+            for (auto [it, end] = dedup_map.equal_range(de->hash); it != end; ++it) {
+                if (it->second.get() == de) {
+                    dedup_map.erase(it);
+                    break;
+                }
+            }
+        }
+        reset_module();
+        cur_stats = compile_stats{};
+
+        throw;
+    }
+
+    // Record the unit of the expressions in the module.
+    for (auto *de : module_entries) {
+        de->unit = retval;
+    }
+
+    reset_module();
+
+    // Finalise the statistics.
+    cur_stats.ir_build -= cur_stats.fn_opt;
+    if (profiling) {
+        if (!jitter->get_lazy()) {
+            jitter->materialize(retval);
+
+            const auto timings = jitter->get_unit_timings(retval);
+            cur_stats.codegen = timings.codegen;
+            cur_stats.link = timings.link;
+        }
+
+        llvm::raw_string_ostream ostr(cur_stats.pass_timings);
+        llvm::reportAndResetTimings(&ostr);
+        ostr.flush();
+    }
+    last_stats = std::move(cur_stats);
+    cur_stats = compile_stats{};
+
+    return retval;
+}
+
+// Asynchronous version of compile(): the module-level optimisation
+// and the generation of the machine code take place in a background
+// thread, while the state can be used to generate the next module.
+// NOTE: the functions in the module can be fetched only after
+// the returned future has become ready. Any error occurring
+// during the compilation is reported by the future. The compile
+// statistics are not recorded for asynchronous compilations.
+std::future<llvm_state::unit_id> llvm_state::compile_async()
+{
+    for (auto &f : *module) {
+        if (!f.isDeclaration()) {
+            set_target_attributes(f);
+        }
+    }
+
+    // NOTE: the background thread operates on the current module and
+    // on its context (which will not be touched any more by this state),
+    // and it uses its own pass manager, as the state's one cannot be
+    // used concurrently.
+    // NOTE: the unit of the expressions in the module will be known
+    // only when the compilation completes. Until then, the names
+    // defined by the module are tracked in order to prevent clashes,
+    // and the aliases to its expressions are queued.
+    async_units.erase(std::remove_if(async_units.begin(), async_units.end(),
+                                     [](const auto &au) {
+                                         std::lock_guard lock{au->mutex};
+                                         return au->done;
+                                     }),
+                      async_units.end());
+    auto au = std::make_shared<async_unit>();
+    for (const auto &gv : module->global_values()) {
+        if (!gv.isDeclaration() && !gv.hasLocalLinkage()) {
+            au->names.emplace(gv.getName());
+        }
+    }
+    for (const auto &p : pending_aliases) {
+        au->names.insert(p.first);
+    }
+    for (auto *de : module_entries) {
+        de->async = au;
+    }
+    async_units.push_back(au);
+
+    auto fut = std::async(std::launch::async, [j = jitter, c = ctx, m = std::move(module), l = opt_level,
+                                               n = compile_threads, a = std::move(pending_aliases), au]() mutable {
+        try {
+            if (l > 0u) {
+                auto b_tm = j->create_target_machine();
+                detail::run_module_pm(*detail::create_module_pm(l, *b_tm), *m);
+            }
+
+            const auto retval = j->add_module(std::move(c), std::move(m), n, a);
+            try {
+                {
+                    std::lock_guard lock{au->mutex};
+
+                    for (const auto &[alias, target] : au->aliases) {
+                        j->add_alias(alias, target);
+                    }
+                    au->unit = retval;
+                    au->done = true;
+                }
+                if (!j->get_lazy()) {
+                    j->materialize(retval);
+                }
+            } catch (...) {
+                // NOTE: the future will not deliver the id
+                // of the unit, thus we remove it from the JIT.
+                try {
+                    j->release(retval);
+                } catch (...) {
+                }
+
+                throw;
+            }
+
+            return retval;
+        } catch (...) {
+            std::lock_guard lock{au->mutex};
+            au->unit.reset();
+            au->done = true;
+            throw;
+        }
+    });
+
+    reset_module();
+    cur_stats = compile_stats{};
+
+    return fut;
+}
+
+void llvm_state::release(unit_id k)
+{
+    jitter->release(k);
+
+    for (auto it = dedup_map.begin(); it != dedup_map.end();) {
+        if (auto au = it->second->async) {
+            std::lock_guard lock{au->mutex};
+            if (au->done) {
+                it->second->unit = au->unit;
+                it->second->async.reset();
+            }
+        }
+
+        if (it->second->unit == k) {
+            it = dedup_map.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // Forget the number of variables of the expressions whose batch
+    // functions do not exist any more (neither in the JIT, nor in the
+    // current module, nor in the modules being compiled).
+    auto batch_n_exists = [this](const std::string &batch_n_name) {
+        if (jitter->has_symbol(batch_n_name) || module->getFunction(batch_n_name) != nullptr
+            || std::any_of(pending_aliases.begin(), pending_aliases.end(),
+                           [&batch_n_name](const auto &p) { return p.first == batch_n_name; })) {
+            return true;
+        }
+
+        return std::any_of(async_units.begin(), async_units.end(), [&batch_n_name](const auto &au) {
+            std::lock_guard lock{au->mutex};
+            return !au->done && au->names.find(batch_n_name) != au->names.end();
+        });
+    };
+    for (auto it = expression_n_vars.begin(); it != expression_n_vars.end();) {
+        if (batch_n_exists(it->first + ".batch_n")) {
+            ++it;
+        } else {
+            it = expression_n_vars.erase(it);
+        }
+    }
+}
+
+std::uintptr_t llvm_state::jit_lookup(const std::string &name)
+{
+    auto sym = llvm::ExitOnError()(jitter->lookup(name));
+    return static_cast<std::uintptr_t>(sym.getAddress());
+}
+
+llvm_state::f_ptr llvm_state::fetch(const std::string &name)
+{
+    return reinterpret_cast<f_ptr>(jit_lookup(name + ".vecargs"));
+}
+
+// Look up the most capable multiversioned variant of
+// the function name supported by the host CPU.
+std::uintptr_t llvm_state::jit_lookup_variant(const std::string &name)
+{
+    for (auto it = std::rbegin(detail::batch_variants); it != std::rend(detail::batch_variants); ++it) {
+        const auto vname = name + it->suffix;
+        if (detail::host_supports(it->features) && jitter->has_symbol(vname)) {
+            return jit_lookup(vname);
+        }
+    }
+
+    return jit_lookup(name);
+}
+
+llvm_state::f_batch_ptr llvm_state::fetch_batch(const std::string &name)
+{
+    return reinterpret_cast<f_batch_ptr>(jit_lookup_variant(name + ".batch"));
+}
+
+llvm_state::f_batch_ptr llvm_state::fetch_batch_soa(const std::string &name)
+{
+    return reinterpret_cast<f_batch_ptr>(jit_lookup_variant(name + ".batch_soa"));
+}
+
+llvm_state::f_batch_n_ptr llvm_state::fetch_batch_n(const std::string &name)
+{
+    return reinterpret_cast<f_batch_n_ptr>(jit_lookup_variant(name + ".batch_n"));
+}
+
+llvm_state::f_batch_n_ptr llvm_state::fetch_batch_soa_n(const std::string &name)
+{
+    return reinterpret_cast<f_batch_n_ptr>(jit_lookup_variant(name + ".batch_soa_n"));
+}
+
+llvm_state::f_batch_strided_ptr llvm_state::fetch_batch_strided(const std::string &name)
+{
+    return reinterpret_cast<f_batch_strided_ptr>(jit_lookup_variant(name + ".batch_strided"));
+}
+
+llvm_state::f_batch_cols_ptr llvm_state::fetch_batch_cols(const std::string &name)
+{
+    return reinterpret_cast<f_batch_cols_ptr>(jit_lookup_variant(name + ".batch_cols"));
+}
+
+llvm_state::f_loss_ptr llvm_state::fetch_loss(const std::string &name, loss_type lt)
+{
+    return reinterpret_cast<f_loss_ptr>(jit_lookup_variant(name + detail::loss_suffix(lt)));
+}
+
+llvm_state::f_multi_ptr llvm_state::fetch_multi(const std::string &name)
+{
+    return reinterpret_cast<f_multi_ptr>(jit_lookup(name));
+}
+
+llvm_state::f_par_ptr llvm_state::fetch_par(const std::string &name)
+{
+    return reinterpret_cast<f_par_ptr>(jit_lookup(name + ".vecargs"));
+}
+
+llvm_state::f_batch_par_ptr llvm_state::fetch_batch_par(const std::string &name)
+{
+    return reinterpret_cast<f_batch_par_ptr>(jit_lookup_variant(name + ".batch"));
+}
+
+llvm_state::f_batch_par_ptr llvm_state::fetch_batch_soa_par(const std::string &name)
+{
+    return reinterpret_cast<f_batch_par_ptr>(jit_lookup_variant(name + ".batch_soa"));
+}
+
+llvm_state::f_batch_n_par_ptr llvm_state::fetch_batch_n_par(const std::string &name)
+{
+    return reinterpret_cast<f_batch_n_par_ptr>(jit_lookup_variant(name + ".batch_n"));
+}
+
+llvm_state::f_batch_n_par_ptr llvm_state::fetch_batch_soa_n_par(const std::string &name)
+{
+    return reinterpret_cast<f_batch_n_par_ptr>(jit_lookup_variant(name + ".batch_soa_n"));
+}
+
+llvm_state::f_batch_strided_par_ptr llvm_state::fetch_batch_strided_par(const std::string &name)
+{
+    return reinterpret_cast<f_batch_strided_par_ptr>(jit_lookup_variant(name + ".batch_strided"));
+}
+
+llvm_state::f_batch_cols_par_ptr llvm_state::fetch_batch_cols_par(const std::string &name)
+{
+    return reinterpret_cast<f_batch_cols_par_ptr>(jit_lookup_variant(name + ".batch_cols"));
+}
+
+llvm_state::f_loss_par_ptr llvm_state::fetch_loss_par(const std::string &name, loss_type lt)
+{
+    return reinterpret_cast<f_loss_par_ptr>(jit_lookup_variant(name + detail::loss_suffix(lt)));
+}
+
+llvm_state::f_ptr_float llvm_state::fetch_float(const std::string &name)
+{
+    return reinterpret_cast<f_ptr_float>(jit_lookup(name + ".vecargs"));
+}
+
+llvm_state::f_batch_ptr_float llvm_state::fetch_batch_float(const std::string &name)
+{
+    return reinterpret_cast<f_batch_ptr_float>(jit_lookup_variant(name + ".batch"));
+}
+
+llvm_state::f_batch_ptr_float llvm_state::fetch_batch_soa_float(const std::string &name)
+{
+    return reinterpret_cast<f_batch_ptr_float>(jit_lookup_variant(name + ".batch_soa"));
+}
+
+llvm_state::f_batch_n_ptr_float llvm_state::fetch_batch_n_float(const std::string &name)
+{
+    return reinterpret_cast<f_batch_n_ptr_float>(jit_lookup_variant(name + ".batch_n"));
+}
+
+llvm_state::f_batch_n_ptr_float llvm_state::fetch_batch_soa_n_float(const std::string &name)
+{
+    return reinterpret_cast<f_batch_n_ptr_float>(jit_lookup_variant(name + ".batch_soa_n"));
+}
+
+llvm_state::f_batch_strided_ptr_float llvm_state::fetch_batch_strided_float(const std::string &name)
+{
+    return reinterpret_cast<f_batch_strided_ptr_float>(jit_lookup_variant(name + ".batch_strided"));
+}
+
+llvm_state::f_batch_cols_ptr_float llvm_state::fetch_batch_cols_float(const std::string &name)
+{
+    return reinterpret_cast<f_batch_cols_ptr_float>(jit_lookup_variant(name + ".batch_cols"));
+}
+
+llvm_state::f_loss_ptr_float llvm_state::fetch_loss_float(const std::string &name, loss_type lt)
+{
+    return reinterpret_cast<f_loss_ptr_float>(jit_lookup_variant(name + detail::loss_suffix(lt)));
+}
+
+llvm_state::f_multi_ptr_float llvm_state::fetch_multi_float(const std::string &name)
+{
+    return reinterpret_cast<f_multi_ptr_float>(jit_lookup(name));
 }
 
 void llvm_state::set_verify(bool f)
@@ -461,4 +2320,196 @@ bool llvm_state::get_verify() const
     return verify;
 }
 
+void llvm_state::set_compile_threads(unsigned n)
+{
+    if (n == 0u) {
+        throw std::invalid_argument("The number of compile threads must be at least 1");
+    }
+    compile_threads = n;
+}
+
+unsigned llvm_state::get_compile_threads() const
+{
+    return compile_threads;
+}
+
+void llvm_state::set_object_cache_dir(std::string dir)
+{
+    jitter->set_object_cache_dir(std::move(dir));
+}
+
+std::string llvm_state::get_object_cache_dir() const
+{
+    return jitter->get_object_cache_dir();
+}
+
+void llvm_state::set_lazy(bool f)
+{
+    jitter->set_lazy(f);
+}
+
+bool llvm_state::get_lazy() const
+{
+    return jitter->get_lazy();
+}
+
+const std::string &llvm_state::get_target_cpu() const
+{
+    return target_cpu;
+}
+
+void llvm_state::set_target_cpu(std::string cpu)
+{
+    target_cpu = std::move(cpu);
+}
+
+const std::string &llvm_state::get_target_features() const
+{
+    return target_features;
+}
+
+void llvm_state::set_target_features(std::string fs)
+{
+    target_features = std::move(fs);
+}
+
+std::string llvm_state::get_opt_pipeline() const
+{
+    return fn_pl ? fn_pl->get_name() : std::string{};
+}
+
+void llvm_state::set_opt_pipeline(std::string name)
+{
+    // NOTE: the pipeline is built here, so that
+    // invalid pipelines are reported immediately.
+    if (name.empty()) {
+        fn_pl.reset();
+    } else {
+        fn_pl = std::make_unique<detail::fn_pipeline>(*tm, std::move(name));
+    }
+}
+
+unsigned llvm_state::get_simd_width() const
+{
+    return simd_width;
+}
+
+void llvm_state::set_simd_width(unsigned w)
+{
+    if (w == 0u || w > 16u || (w & (w - 1u)) != 0u) {
+        throw std::invalid_argument("Invalid SIMD width " + std::to_string(w)
+                                    + ": the width must be a power of 2 not greater than 16");
+    }
+    simd_width = w;
+}
+
+unsigned llvm_state::get_codegen_width() const
+{
+    return cg_width;
+}
+
+bool llvm_state::get_batch_soa() const
+{
+    return batch_soa;
+}
+
+void llvm_state::set_batch_soa(bool f)
+{
+    batch_soa = f;
+}
+
+bool llvm_state::get_single_precision() const
+{
+    return single_precision;
+}
+
+void llvm_state::set_single_precision(bool f)
+{
+    single_precision = f;
+}
+
+llvm::Type *llvm_state::get_fp_type()
+{
+    return single_precision ? builder->getFloatTy() : builder->getDoubleTy();
+}
+
+bool llvm_state::get_loss_kernels() const
+{
+    return loss_kernels;
+}
+
+void llvm_state::set_loss_kernels(bool f)
+{
+    loss_kernels = f;
+}
+
+bool llvm_state::get_batch_strided() const
+{
+    return batch_strided;
+}
+
+void llvm_state::set_batch_strided(bool f)
+{
+    batch_strided = f;
+}
+
+bool llvm_state::get_verbose() const
+{
+    return verbose;
+}
+
+void llvm_state::set_verbose(bool f)
+{
+    verbose = f;
+}
+
+bool llvm_state::get_batch_multiversioning() const
+{
+    return batch_multiversioning;
+}
+
+void llvm_state::set_batch_multiversioning(bool f)
+{
+    if (f && llvm::Triple(jitter->get_target_triple()).getArch() != llvm::Triple::x86_64) {
+        throw std::invalid_argument("Batch multiversioning is available only on x86-64");
+    }
+    batch_multiversioning = f;
+}
+
+bool llvm_state::get_profiling() const
+{
+    return profiling;
+}
+
+void llvm_state::set_profiling(bool f)
+{
+    llvm::TimePassesIsEnabled = f;
+    profiling = f;
+}
+
+const llvm_state::compile_stats &llvm_state::get_compile_stats() const
+{
+    return last_stats;
+}
+
+bool llvm_state::get_gdb_support() const
+{
+    return jitter->get_gdb_support();
+}
+
+void llvm_state::set_gdb_support(bool f)
+{
+    jitter->set_gdb_support(f);
+}
+
+bool llvm_state::get_perf_support() const
+{
+    return jitter->get_perf_support();
+}
+
+void llvm_state::set_perf_support(bool f)
+{
+    jitter->set_perf_support(f);
+}
+
 } // namespace lambdifier
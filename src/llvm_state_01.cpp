@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <limits>
@@ -20,6 +21,7 @@
 #include <llvm/Support/raw_ostream.h>
 
 #include <lambdifier/detail/check_symbol_name.hpp>
+#include <lambdifier/detail/scoped_timer.hpp>
 #include <lambdifier/detail/string_conv.hpp>
 #include <lambdifier/expression.hpp>
 #include <lambdifier/function_call.hpp>
@@ -59,7 +61,9 @@ expression llvm_value_to_expression(const llvm::Value *val,
         if (llvm::isa<llvm::Constant>(val)) {
             if (auto cfp = llvm::dyn_cast<llvm::ConstantFP>(val)) {
                 // Double-precision constant.
-                return expression{number{cfp->getValueAPF().convertToDouble()}};
+                // NOTE: the constants are floats in single-precision mode.
+                return expression{number{cfp->getType()->isFloatTy() ? cfp->getValueAPF().convertToFloat()
+                                                                     : cfp->getValueAPF().convertToDouble()}};
             } else if (auto cint = llvm::dyn_cast<llvm::ConstantInt>(val)) {
                 // 32-bit signed integer.
                 const auto &v = cint->getValue();
@@ -245,7 +249,7 @@ void llvm_state::add_llvm_inst_to_value_exp_map(std::unordered_map<const llvm::V
 expression llvm_state::to_expression(const std::string &name) const
 {
     // Fetch the function.
-    auto f = module->getFunction(name);
+    auto f = get_function(name);
     if (f == nullptr || f->empty()) {
         throw std::runtime_error("Unable to convert an IR call to the function '" + name
                                  + "' into an expression: the function is either not present in the "
@@ -290,7 +294,7 @@ expression llvm_state::to_expression(const std::string &name) const
 
 std::string llvm_state::dump_function(const std::string &name) const
 {
-    if (auto f = module->getFunction(name)) {
+    if (auto f = get_function(name)) {
         std::string out;
         llvm::raw_string_ostream ostr(out);
         f->print(ostr);
@@ -373,11 +377,18 @@ llvm::Function *llvm_state::taylor_add_sv_diff(const std::string &, std::uint32_
 
 void llvm_state::add_taylor(const std::string &name, std::vector<expression> sys, unsigned max_order)
 {
+    // NOTE: this includes the time spent in optimize_function(),
+    // which is subtracted in compile().
+    detail::scoped_timer timer{cur_stats.ir_build};
+
     // TODO taylor function naming.
     detail::check_symbol_name(name);
 
-    if (module->getNamedValue(name) != nullptr) {
-        throw std::invalid_argument("The name '" + name + "' already exists in the module");
+    check_name_availability(name);
+
+    if (single_precision) {
+        throw std::invalid_argument("Cannot add the Taylor integrator '" + name
+                                    + "': Taylor integrators are available only in double precision");
     }
 
     if (max_order == 0u) {
@@ -387,6 +398,11 @@ void llvm_state::add_taylor(const std::string &name, std::vector<expression> sys
     // Record the number of equations/variables.
     const auto n_eq = sys.size();
 
+    // NOTE: if the system contains parameters, the integrator
+    // takes the parameter values as last argument.
+    with_params
+        = std::any_of(sys.begin(), sys.end(), [](const expression &ex) { return ex.get_n_params() != 0u; });
+
     // Decompose the system of equations.
     const auto dc = taylor_decompose(std::move(sys));
 
@@ -447,9 +463,11 @@ void llvm_state::add_taylor(const std::string &name, std::vector<expression> sys
     // Prepare the main function prototype. The arguments are:
     // - double pointer to in/out array,
     // - double (timestep),
-    // - 32-bit integer (order of the derivative).
+    // - 32-bit integer (order of the derivative),
+    // - const double pointer to the parameter values (if needed).
     std::vector<llvm::Type *> fargs{llvm::PointerType::getUnqual(builder->getDoubleTy()), builder->getDoubleTy(),
                                     builder->getInt32Ty()};
+    add_param_arg(fargs);
     // The function does not return anything.
     auto *ft = llvm::FunctionType::get(builder->getVoidTy(), fargs, false);
     assert(ft != nullptr);
@@ -464,6 +482,7 @@ void llvm_state::add_taylor(const std::string &name, std::vector<expression> sys
     (arg_it++)->setName("h");
     auto order_arg = arg_it;
     arg_it->setName("order");
+    setup_param_arg(*f);
 
     // Create a new basic block to start insertion into.
     auto *bb = llvm::BasicBlock::Create(get_context(), "entry", f);
@@ -633,10 +652,12 @@ void llvm_state::add_taylor(const std::string &name, std::vector<expression> sys
     // Verify it.
     verify_function(f);
 
-    // Run the optimization pass.
-    if (opt_level > 0u) {
-        pm->run(*module);
+    // Run the function-level optimisation passes
+    // on the newly-added functions.
+    for (auto diff_f : u_diff_funcs) {
+        optimize_function(*diff_f);
     }
+    optimize_function(*f);
 }
 
 } // namespace lambdifier
@@ -0,0 +1,188 @@
+#include <cctype>
+#include <fstream>
+#include <ios>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/Attributes.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalAlias.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Type.h>
+#include <llvm/Support/CodeGen.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include <lambdifier/detail/pipeline.hpp>
+#include <lambdifier/llvm_state.hpp>
+
+namespace lambdifier
+{
+
+namespace detail
+{
+
+namespace
+{
+
+// Turn s into a valid C identifier.
+std::string to_c_identifier(const std::string &s)
+{
+    auto retval = s;
+    for (auto &c : retval) {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_') {
+            c = '_';
+        }
+    }
+    if (retval.empty() || std::isdigit(static_cast<unsigned char>(retval[0]))) {
+        retval.insert(retval.begin(), '_');
+    }
+    return retval;
+}
+
+// Produce the C representation of the LLVM type t.
+// is_const signals whether a pointer type points to const data
+// (for pointers to pointers, the constness applies to all the
+// levels of indirection, e.g., "const double *const *").
+std::string llvm_type_to_c(llvm::Type *t, bool is_const = false)
+{
+    if (t->isVoidTy()) {
+        return "void";
+    } else if (t->isDoubleTy()) {
+        return "double";
+    } else if (t->isFloatTy()) {
+        return "float";
+    } else if (t->isIntegerTy(32)) {
+        return "uint32_t";
+    } else if (t->isIntegerTy(64)) {
+        return "uint64_t";
+    } else if (auto pt = llvm::dyn_cast<llvm::PointerType>(t)) {
+        auto *et = pt->getElementType();
+        if (et->isPointerTy()) {
+            return llvm_type_to_c(et, is_const) + (is_const ? "const *" : "*");
+        }
+        return (is_const ? "const " : "") + llvm_type_to_c(et) + " *";
+    }
+
+    std::string out;
+    llvm::raw_string_ostream ostr(out);
+    t->print(ostr);
+    throw std::invalid_argument("The LLVM type '" + ostr.str() + "' cannot be represented in C");
+}
+
+} // namespace
+
+} // namespace detail
+
+// Emit the current module as a relocatable (position-independent)
+// object file at the given path. The object can then be linked into
+// executables or shared libraries without requiring LLVM at runtime
+// (the system math library may be required). The module is not consumed,
+// and it can still be compiled via compile() afterwards.
+void llvm_state::emit_object(const std::string &path)
+{
+    for (auto &f : *module) {
+        if (!f.isDeclaration()) {
+            set_target_attributes(f);
+        }
+    }
+
+    // NOTE: both the module-level optimisation and the
+    // codegen passes may alter the IR, thus we operate on a copy
+    // of the module.
+    auto m = llvm::CloneModule(*module);
+
+    if (opt_level > 0u) {
+        detail::run_module_pm(*pm, *m);
+    }
+
+    // Add the aliases created by the deduplication
+    // of the expressions.
+    for (const auto &[alias, target] : pending_aliases) {
+        llvm::GlobalAlias::create(alias, m->getFunction(target));
+    }
+
+    auto tm = jitter->create_target_machine(true);
+
+    llvm::SmallVector<char, 0> buffer;
+    llvm::raw_svector_ostream ostr(buffer);
+
+    llvm::legacy::PassManager epm;
+#if LLVM_VERSION_MAJOR == 10
+    if (tm->addPassesToEmitFile(epm, ostr, nullptr, llvm::CGFT_ObjectFile)) {
+#else
+    if (tm->addPassesToEmitFile(epm, ostr, nullptr, llvm::TargetMachine::CGFT_ObjectFile)) {
+#endif
+        throw std::invalid_argument("The target machine cannot emit object files");
+    }
+    epm.run(*m);
+
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    ofs.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    if (!ofs) {
+        throw std::runtime_error("Error writing the object file '" + path + "'");
+    }
+}
+
+// Produce a C header with the declarations of the functions
+// exported by the object file created by emit_object().
+// NOTE: since the names of the functions may contain characters
+// which are not valid in C identifiers (e.g., "f.vecargs"), we use
+// asm labels to map valid C identifiers (e.g., "f_vecargs")
+// to the actual symbol names.
+std::string llvm_state::dump_c_header() const
+{
+    const auto guard = "LAMBDIFIER_" + detail::to_c_identifier(module_name) + "_H";
+    const auto prefix = jitter->get_data_layout().getGlobalPrefix();
+
+    std::string out = "// Generated by lambdifier from the module '" + module_name + "'.\n";
+    out += "#ifndef " + guard + "\n#define " + guard + "\n\n#include <stdint.h>\n\n";
+    out += "#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n";
+
+    std::unordered_set<std::string> c_names;
+    // Add the declaration of the function f under the name name.
+    auto add_decl = [&](const std::string &name, const llvm::Function &f) {
+        const auto c_name = detail::to_c_identifier(name);
+        if (!c_names.insert(c_name).second) {
+            throw std::invalid_argument("Cannot generate a C header for the module: the C identifier '" + c_name
+                                        + "' would be used for multiple functions");
+        }
+
+        out += detail::llvm_type_to_c(f.getReturnType()) + " " + c_name + "(";
+        for (const auto &arg : f.args()) {
+            if (arg.getArgNo() != 0u) {
+                out += ", ";
+            }
+            out += detail::llvm_type_to_c(arg.getType(), arg.onlyReadsMemory());
+        }
+        out += ") __asm__(\"";
+        if (prefix != '\0') {
+            out += prefix;
+        }
+        out += name + "\");\n";
+    };
+
+    for (const auto &f : module->functions()) {
+        if (f.isDeclaration() || f.hasLocalLinkage()) {
+            continue;
+        }
+
+        add_decl(std::string{f.getName()}, f);
+    }
+    for (const auto &[alias, target] : pending_aliases) {
+        add_decl(alias, *module->getFunction(target));
+    }
+
+    out += "\n#ifdef __cplusplus\n}\n#endif\n\n#endif\n";
+
+    return out;
+}
+
+} // namespace lambdifier
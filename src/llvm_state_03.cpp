@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <lambdifier/detail/jit.hpp>
+#include <lambdifier/detail/thread_pool.hpp>
+#include <lambdifier/llvm_state.hpp>
+
+namespace lambdifier
+{
+
+namespace detail
+{
+
+namespace
+{
+
+// Assumed size of the L2 cache, used to pick the chunk size.
+constexpr std::uint64_t l2_cache_size = 256u * 1024u;
+
+// The chunk sizes are multiples of this value, so that the SIMD loops
+// of the batch functions run on full vectors (apart from the last
+// chunk) and each chunk writes whole cache lines of the output.
+constexpr std::uint64_t chunk_granularity = 64;
+
+// Automatic chunk size for the parallel evaluation of n points
+// of an expression with nvars variables on n_threads threads.
+std::uint64_t auto_chunk_size(std::uint64_t n, std::size_t nvars, unsigned n_threads)
+{
+    // Fit the input and the output of a chunk in the L2 cache.
+    auto retval = l2_cache_size / (sizeof(double) * (static_cast<std::uint64_t>(nvars) + 1u));
+
+    // NOTE: with few chunks per thread, work stealing cannot
+    // do much for the load balancing, thus we make sure
+    // there are at least a few chunks per thread.
+    retval = std::min(retval, n / (4u * static_cast<std::uint64_t>(n_threads)));
+
+    return std::max(chunk_granularity, retval / chunk_granularity * chunk_granularity);
+}
+
+} // namespace
+
+} // namespace detail
+
+void llvm_state::eval_batch_parallel(const std::string &name, double *out, const double *in, std::uint64_t n)
+{
+    const auto it = expression_n_vars.find(name);
+    if (it == expression_n_vars.end()) {
+        throw std::invalid_argument("Cannot evaluate in parallel the expression '" + name
+                                    + "': the expression was not added to the state");
+    }
+    const auto nvars = it->second;
+
+    // NOTE: check that the code is available, as the
+    // lookup in fetch_batch_n() would abort otherwise.
+    if (!jitter->has_symbol(name + ".batch_n")) {
+        throw std::invalid_argument("Cannot evaluate in parallel the expression '" + name
+                                    + "': the expression has not been compiled");
+    }
+
+    auto f = fetch_batch_n(name);
+
+    if (!pool || pool->get_n_threads() != eval_threads) {
+        // NOTE: destroy the old pool first, so that
+        // its threads do not linger around.
+        pool.reset();
+        pool = std::make_unique<detail::thread_pool>(eval_threads);
+    }
+
+    const auto chunk_size
+        = eval_chunk_size == 0u ? detail::auto_chunk_size(n, nvars, eval_threads) : eval_chunk_size;
+
+    pool->parallel_for(n, chunk_size, [f, out, in, nvars](std::uint64_t b, std::uint64_t e) {
+        f(out + b, in + b * nvars, e - b);
+    });
+}
+
+unsigned llvm_state::get_eval_threads() const
+{
+    return eval_threads;
+}
+
+void llvm_state::set_eval_threads(unsigned n)
+{
+    if (n == 0u) {
+        throw std::invalid_argument("The number of evaluation threads must be at least 1");
+    }
+    eval_threads = n;
+}
+
+std::uint64_t llvm_state::get_eval_chunk_size() const
+{
+    return eval_chunk_size;
+}
+
+void llvm_state::set_eval_chunk_size(std::uint64_t n)
+{
+    eval_chunk_size = n;
+}
+
+} // namespace lambdifier
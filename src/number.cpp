@@ -4,6 +4,8 @@
 
 #include <llvm/ADT/APFloat.h>
 #include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Value.h>
 
 #include <lambdifier/expression.hpp>
@@ -27,6 +29,15 @@ double number::get_value() const
 
 llvm::Value *number::codegen(llvm_state &s) const
 {
+    if (const auto width = s.get_codegen_width(); width > 1u) {
+        // NOTE: in vector mode, splat the value.
+        return llvm::ConstantFP::get(llvm::VectorType::get(s.get_fp_type(), width), value);
+    }
+
+    if (s.get_single_precision()) {
+        return llvm::ConstantFP::get(s.get_fp_type(), value);
+    }
+
     return llvm::ConstantFP::get(s.get_context(), llvm::APFloat(value));
 }
 
@@ -0,0 +1,166 @@
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <llvm/ADT/APFloat.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Value.h>
+
+#include <lambdifier/detail/string_conv.hpp>
+#include <lambdifier/expression.hpp>
+#include <lambdifier/llvm_state.hpp>
+#include <lambdifier/number.hpp>
+#include <lambdifier/param.hpp>
+
+namespace lambdifier
+{
+
+param::param(std::uint32_t index) : index(index) {}
+
+param::param(const param &) = default;
+param::param(param &&) noexcept = default;
+
+param::~param() = default;
+
+std::uint32_t param::get_index() const
+{
+    return index;
+}
+
+void param::set_index(std::uint32_t idx)
+{
+    index = idx;
+}
+
+llvm::Value *param::codegen(llvm_state &s) const
+{
+    auto *pars = s.get_param_values();
+    if (pars == nullptr) {
+        throw std::invalid_argument("Cannot generate the code for the parameter '" + to_string()
+                                    + "': the function being generated does not take the parameter values");
+    }
+
+    auto &builder = s.get_builder();
+
+    // Load the value from the array of the parameter values.
+    auto *ptr = builder.CreateConstInBoundsGEP1_32(s.get_fp_type(), pars, index, "par_ptr");
+    llvm::Value *retval = builder.CreateLoad(s.get_fp_type(), ptr, "par_" + detail::li_to_string(index));
+
+    if (const auto width = s.get_codegen_width(); width > 1u) {
+        // NOTE: in vector mode, splat the value.
+        retval = builder.CreateVectorSplat(width, retval);
+    }
+
+    return retval;
+}
+
+std::string param::to_string() const
+{
+    return "par[" + detail::li_to_string(index) + "]";
+}
+
+double param::evaluate(std::unordered_map<std::string, double> &in) const
+{
+    return in[to_string()];
+}
+
+void param::evaluate(std::unordered_map<std::string, std::vector<double>> &in, std::vector<double> &out) const
+{
+    // NOTE: same as in variable::evaluate().
+    if (auto it = in.find(to_string()); it != in.end()) {
+        out = it->second;
+    } else {
+        out = std::vector<double>(out.size(), 0.);
+    }
+}
+
+// leaves of the tree have no connected nodes.
+void param::compute_connections(std::vector<std::vector<unsigned>> &node_connections, unsigned &node_counter) const
+{
+    node_connections.push_back(std::vector<unsigned>());
+    node_counter++;
+}
+
+expression param::diff(const std::string &s) const
+{
+    if (s == to_string()) {
+        return expression{number{1}};
+    } else {
+        return expression{number{0}};
+    }
+}
+
+// NOTE: in the Taylor decomposition, each parameter is
+// assigned to its own u variable, whose initial value
+// is loaded from the array of the parameter values.
+llvm::Value *param::taylor_init(llvm_state &s, llvm::Value *) const
+{
+    return codegen(s);
+}
+
+llvm::Function *param::taylor_diff(llvm_state &s, const std::string &name, std::uint32_t,
+                                   const std::unordered_map<std::uint32_t, number> &) const
+{
+    auto &builder = s.get_builder();
+
+    // Check the function name.
+    if (s.get_module().getFunction(name) != nullptr) {
+        throw std::invalid_argument("Cannot add the function '" + name
+                                    + "' when building the Taylor derivative of a parameter: the "
+                                      "function already exists in the LLVM module");
+    }
+
+    // Prepare the function prototype. The arguments are:
+    // - const double pointer to the derivatives array,
+    // - 32-bit integer (order of the derivative).
+    std::vector<llvm::Type *> fargs{llvm::PointerType::getUnqual(builder.getDoubleTy()), builder.getInt32Ty()};
+
+    // The function will return the n-th derivative as a double.
+    auto *ft = llvm::FunctionType::get(builder.getDoubleTy(), fargs, false);
+    assert(ft != nullptr);
+
+    // Now create the function. Don't need to call it from outside,
+    // thus internal linkage.
+    auto *f = llvm::Function::Create(ft, llvm::Function::InternalLinkage, name, s.get_module());
+    assert(f != nullptr);
+
+    auto arg_it = f->args().begin();
+    arg_it->setName("diff_ptr");
+    (++arg_it)->setName("order");
+
+    auto *bb = llvm::BasicBlock::Create(s.get_context(), "entry", f);
+    assert(bb != nullptr);
+    builder.SetInsertPoint(bb);
+
+    // NOTE: the derivatives of order
+    // greater than zero are all zero.
+    builder.CreateRet(llvm::ConstantFP::get(s.get_context(), llvm::APFloat(0.)));
+
+    s.verify_function(f);
+
+    return f;
+}
+
+inline namespace literals
+{
+
+expression operator""_par(unsigned long long n)
+{
+    if (n > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::overflow_error("The index of a parameter, " + std::to_string(n) + ", is too large");
+    }
+
+    return expression{param{static_cast<std::uint32_t>(n)}};
+}
+
+} // namespace literals
+
+} // namespace lambdifier
@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/SmallVector.h>
+
+#include <lambdifier/binary_operator.hpp>
+#include <lambdifier/expression.hpp>
+#include <lambdifier/function_call.hpp>
+#include <lambdifier/llvm_state.hpp>
+#include <lambdifier/number.hpp>
+#include <lambdifier/tiered_function.hpp>
+#include <lambdifier/variable.hpp>
+
+namespace lambdifier
+{
+
+namespace detail
+{
+
+namespace
+{
+
+// Counter used to generate unique names
+// for the compiled tiered functions.
+std::atomic<unsigned long long> tiered_counter = 0;
+
+// Fast paths for the functions with 1 or 2 arguments,
+// indexed by the name of the function.
+double (*unary_func(const std::string &name))(double)
+{
+    static const std::unordered_map<std::string, double (*)(double)> fmap
+        = {{"llvm.sin", [](double x) { return std::sin(x); }},     {"llvm.cos", [](double x) { return std::cos(x); }},
+           {"tan", [](double x) { return std::tan(x); }},          {"asin", [](double x) { return std::asin(x); }},
+           {"acos", [](double x) { return std::acos(x); }},        {"atan", [](double x) { return std::atan(x); }},
+           {"llvm.exp", [](double x) { return std::exp(x); }},     {"llvm.exp2", [](double x) { return std::exp2(x); }},
+           {"llvm.log", [](double x) { return std::log(x); }},     {"llvm.log2", [](double x) { return std::log2(x); }},
+           {"llvm.log10", [](double x) { return std::log10(x); }}, {"llvm.sqrt", [](double x) { return std::sqrt(x); }},
+           {"llvm.fabs", [](double x) { return std::abs(x); }}};
+
+    const auto it = fmap.find(name);
+    return it == fmap.end() ? nullptr : it->second;
+}
+
+double (*binary_func(const std::string &name))(double, double)
+{
+    static const std::unordered_map<std::string, double (*)(double, double)> fmap
+        = {{"llvm.pow", [](double x, double y) { return std::pow(x, y); }},
+           {"atan2", [](double x, double y) { return std::atan2(x, y); }}};
+
+    const auto it = fmap.find(name);
+    return it == fmap.end() ? nullptr : it->second;
+}
+
+// Append to tape the instructions for the evaluation of e
+// (in reverse Polish notation). The return value is the maximum
+// size of the stack needed to evaluate e.
+std::uint32_t build_tape(std::vector<tape_instr> &tape, const expression &e, const std::vector<std::string> &vars)
+{
+    using kind = tape_instr::kind;
+
+    if (auto num_ptr = e.extract<number>()) {
+        tape_instr ins{kind::num};
+        ins.value = num_ptr->get_value();
+        tape.push_back(std::move(ins));
+
+        return 1;
+    } else if (auto var_ptr = e.extract<variable>()) {
+        const auto it = std::lower_bound(vars.begin(), vars.end(), var_ptr->get_name());
+        assert(it != vars.end() && *it == var_ptr->get_name());
+
+        tape_instr ins{kind::var};
+        ins.idx = static_cast<std::uint32_t>(it - vars.begin());
+        tape.push_back(std::move(ins));
+
+        return 1;
+    } else if (auto bo_ptr = e.extract<binary_operator>()) {
+        const auto l_size = build_tape(tape, bo_ptr->get_lhs(), vars);
+        const auto r_size = build_tape(tape, bo_ptr->get_rhs(), vars);
+
+        switch (bo_ptr->get_op()) {
+            case '+':
+                tape.emplace_back(kind::add);
+                break;
+            case '-':
+                tape.emplace_back(kind::sub);
+                break;
+            case '*':
+                tape.emplace_back(kind::mul);
+                break;
+            default:
+                assert(bo_ptr->get_op() == '/');
+                tape.emplace_back(kind::div);
+        }
+
+        // NOTE: the lhs is on the stack while
+        // the rhs is being evaluated.
+        return std::max(l_size, r_size + 1u);
+    } else if (auto call_ptr = e.extract<function_call>()) {
+        const auto &args = call_ptr->get_args();
+        if (args.size() > std::numeric_limits<std::uint32_t>::max() - 1u) {
+            throw std::overflow_error("Too many arguments in a function call");
+        }
+
+        std::uint32_t retval = 1;
+        for (decltype(args.size()) i = 0; i < args.size(); ++i) {
+            retval = std::max(retval, build_tape(tape, args[i], vars) + static_cast<std::uint32_t>(i));
+        }
+
+        tape_instr ins{kind::calln};
+        if (args.size() == 1u && (ins.f1 = unary_func(call_ptr->get_name()))) {
+            ins.k = kind::call1;
+        } else if (args.size() == 2u && (ins.f2 = binary_func(call_ptr->get_name()))) {
+            ins.k = kind::call2;
+        } else if ((ins.fn = call_ptr->get_eval_num_f())) {
+            ins.idx = static_cast<std::uint32_t>(args.size());
+        } else {
+            throw std::invalid_argument("The function '" + call_ptr->get_display_name()
+                                        + "' cannot be evaluated by the interpreter");
+        }
+        tape.push_back(std::move(ins));
+
+        return retval;
+    }
+
+    throw std::invalid_argument("The expression '" + e.to_string() + "' cannot be evaluated by the interpreter");
+}
+
+} // namespace
+
+} // namespace detail
+
+tiered_function::tiered_function(expression e, const llvm_state &s, unsigned long long t)
+    : ex(std::move(e)), vars(ex.get_variables()), parent(s),
+      name("tiered_" + std::to_string(++detail::tiered_counter)), threshold(t)
+{
+    max_stack = detail::build_tape(tape, ex, vars);
+
+    // A null threshold means that the compilation
+    // starts immediately.
+    if (threshold == 0u) {
+        compiler = std::thread([this]() { compile(); });
+    }
+}
+
+tiered_function::~tiered_function()
+{
+    if (compiler.joinable()) {
+        compiler.join();
+    }
+}
+
+// Evaluate the tape.
+double tiered_function::interpret(const double *args) const
+{
+    using kind = detail::tape_instr::kind;
+
+    llvm::SmallVector<double, 32> stack;
+    stack.reserve(max_stack);
+    std::vector<double> fargs;
+
+    for (const auto &ins : tape) {
+        switch (ins.k) {
+            case kind::num:
+                stack.push_back(ins.value);
+                break;
+            case kind::var:
+                stack.push_back(args[ins.idx]);
+                break;
+            case kind::add: {
+                const auto r = stack.pop_back_val();
+                stack.back() += r;
+                break;
+            }
+            case kind::sub: {
+                const auto r = stack.pop_back_val();
+                stack.back() -= r;
+                break;
+            }
+            case kind::mul: {
+                const auto r = stack.pop_back_val();
+                stack.back() *= r;
+                break;
+            }
+            case kind::div: {
+                const auto r = stack.pop_back_val();
+                stack.back() /= r;
+                break;
+            }
+            case kind::call1:
+                stack.back() = ins.f1(stack.back());
+                break;
+            case kind::call2: {
+                const auto r = stack.pop_back_val();
+                stack.back() = ins.f2(stack.back(), r);
+                break;
+            }
+            case kind::calln:
+                fargs.assign(stack.end() - ins.idx, stack.end());
+                stack.resize(stack.size() - ins.idx);
+                stack.push_back(ins.fn(fargs));
+        }
+    }
+
+    assert(stack.size() == 1u);
+    return stack.back();
+}
+
+// Compile the expression using a sibling of the parent state.
+// NOTE: this is run in the background thread.
+void tiered_function::compile()
+{
+    try {
+        state = std::make_unique<llvm_state>(name, parent);
+        state->add_expression(name, ex);
+        state->compile();
+        jit_ptr.store(state->fetch(name), std::memory_order_release);
+    } catch (...) {
+        compile_error = std::current_exception();
+    }
+}
+
+double tiered_function::operator()(const double *args)
+{
+    if (const auto f = jit_ptr.load(std::memory_order_acquire)) {
+        return f(args);
+    }
+
+    if (n_calls.fetch_add(1, std::memory_order_relaxed) + 1u == threshold) {
+        compiler = std::thread([this]() { compile(); });
+    }
+
+    return interpret(args);
+}
+
+const std::vector<std::string> &tiered_function::get_variables() const
+{
+    return vars;
+}
+
+unsigned long long tiered_function::get_threshold() const
+{
+    return threshold;
+}
+
+bool tiered_function::is_compiled() const
+{
+    return jit_ptr.load(std::memory_order_acquire) != nullptr;
+}
+
+// NOTE: this must not be called concurrently
+// with the other member functions.
+void tiered_function::wait()
+{
+    if (compiler.joinable()) {
+        compiler.join();
+    }
+
+    if (compile_error) {
+        std::rethrow_exception(compile_error);
+    }
+}
+
+} // namespace lambdifier
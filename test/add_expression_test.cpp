@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include <lambdifier/expression.hpp>
+#include <lambdifier/llvm_state.hpp>
+#include <lambdifier/math_functions.hpp>
+#include <lambdifier/number.hpp>
+#include <lambdifier/variable.hpp>
+
+using namespace lambdifier;
+using namespace std::chrono;
+
+// Build the i-th expression of the benchmark.
+expression make_expression(unsigned i)
+{
+    auto x = "x"_var, y = "y"_var;
+    auto c1 = expression{number{i + 1.}}, c2 = expression{number{i + 2.}};
+
+    return sin(x * c1) * cos(y) + x * y / c2 + exp(x - y * c1) - pow(x, c2);
+}
+
+// ------------------------------------ Main --------------------------------------
+int main()
+{
+    // Number of blocks of expressions, and
+    // number of expressions per block.
+    const unsigned n_blocks = 10, block_size = 100;
+
+    llvm_state s{"add_expression"}, s_par{"add_expression_par"}, s_lazy{"add_expression_lazy"};
+    s_par.set_compile_threads(std::max(1u, std::thread::hardware_concurrency()));
+    s_lazy.set_lazy(true);
+
+    // We time the addition of each block of expressions to the
+    // module. As the module grows, the cost of add_expression()
+    // should stay roughly constant.
+    for (auto i = 0u; i < n_blocks; ++i) {
+        auto start = high_resolution_clock::now();
+        for (auto j = 0u; j < block_size; ++j) {
+            const auto idx = i * block_size + j;
+            s.add_expression("f_" + std::to_string(idx), make_expression(idx), 100);
+            s_par.add_expression("f_" + std::to_string(idx), make_expression(idx), 100);
+            s_lazy.add_expression("f_" + std::to_string(idx), make_expression(idx), 100);
+        }
+        auto stop = high_resolution_clock::now();
+        auto duration = duration_cast<microseconds>(stop - start);
+        std::cout << "Average add_expression() time for the expressions in [" << i * block_size << ", "
+                  << (i + 1u) * block_size << ") (microseconds): " << duration.count() / block_size << "\n";
+    }
+
+    // Time the compilation of the whole module.
+    auto start = high_resolution_clock::now();
+    s.compile();
+    // NOTE: trigger the compilation.
+    s.fetch("f_0");
+    auto stop = high_resolution_clock::now();
+    std::cout << "Time to compile the module (microseconds): " << duration_cast<microseconds>(stop - start).count()
+              << "\n";
+
+    // Same, but using multiple compile threads.
+    start = high_resolution_clock::now();
+    s_par.compile();
+    stop = high_resolution_clock::now();
+    std::cout << "Time to compile the module with " << s_par.get_compile_threads()
+              << " threads (microseconds): " << duration_cast<microseconds>(stop - start).count() << "\n";
+
+    // Lazy mode: only the function which is
+    // actually invoked is compiled.
+    start = high_resolution_clock::now();
+    s_lazy.compile();
+    const double args[] = {1., 2.};
+    s_lazy.fetch("f_0")(args);
+    stop = high_resolution_clock::now();
+    std::cout << "Time to compile the module in lazy mode and invoke one function (microseconds): "
+              << duration_cast<microseconds>(stop - start).count() << "\n";
+
+    return 0;
+}
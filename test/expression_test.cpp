@@ -50,6 +50,18 @@ TEST_CASE("equality comparisons")
     }
 }
 
+TEST_CASE("hashing")
+{
+    expression ex1 = "x"_var + 3_num + "y"_var * (cos("x"_var + 3_num)) / pow("x"_var + 3_num, "z"_var + 3_num);
+    expression ex2 = "x"_var + 3_num + "y"_var * (cos("x"_var + 3_num)) / pow("x"_var + 3_num, "z"_var + 3_num);
+    expression ex3 = "x"_var + 3_num + "y"_var * (sin("x"_var + 3_num)) / pow("x"_var + 3_num, "z"_var + 3_num);
+    expression ex4 = "x"_var - 3_num + "y"_var * (cos("x"_var + 3_num)) / pow("x"_var + 3_num, "z"_var + 3_num);
+    REQUIRE(ex1.hash() == ex2.hash());
+    REQUIRE(ex1.hash() != ex3.hash());
+    REQUIRE(ex1.hash() != ex4.hash());
+    REQUIRE(("x"_var + "y"_var).hash() != ("y"_var + "x"_var).hash());
+}
+
 TEST_CASE("call operator")
 {
     // We test on a number
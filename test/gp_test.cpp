@@ -189,8 +189,8 @@ int main()
     // Uncomment for simpler expression.
     // ex = "x"_var * "x"_var + "y"_var + "y"_var * "y"_var - "y"_var * "x"_var;
     std::cout << "ex: " << ex << "\n";
-    s.add_expression("f", ex, 10000);
-    s.add_expression("g", ex, 20);
+    s.set_loss_kernels(true);
+    s.add_expression("f", ex);
     std::cout << s.dump() << '\n';
 
     // 1 - We time the compilation into llvm
@@ -253,26 +253,50 @@ int main()
               << 1. / (static_cast<double>(duration.count()) / N) << "M\n";
 
     // 6 - we time the function call from llvm batch
-    auto func_batch = s.fetch_batch("f");
+    // NOTE: the same function is used for all the batch sizes.
+    auto func_batch = s.fetch_batch_n("f");
     out = std::vector<double>(10000, 0.12345);
     auto llvm_batch_args = random_args_batch(2, 10000);
     start = high_resolution_clock::now();
-    func_batch(out.data(), llvm_batch_args.data());
+    func_batch(out.data(), llvm_batch_args.data(), 10000);
     stop = high_resolution_clock::now();
     duration = duration_cast<microseconds>(stop - start);
     std::cout << "Millions of evaluations per second (llvm batch 10000): "
               << 1. / (static_cast<double>(duration.count()) / N) << "M\n";
 
     // 7 - we time the function call from llvm batch (20).
-    auto g_batch = s.fetch_batch("g");
     start = high_resolution_clock::now();
     for (auto i = 0u; i < 500u; ++i) {
-        g_batch(out.data() + i * 20, llvm_batch_args.data() + 2 * i * 20);
+        func_batch(out.data() + i * 20, llvm_batch_args.data() + 2 * i * 20, 20);
     }
     stop = high_resolution_clock::now();
     duration = duration_cast<microseconds>(stop - start);
     std::cout << "Millions of evaluations per second (llvm batch 20): "
               << 1. / (static_cast<double>(duration.count()) / N) << "M\n";
 
+    // 8 - we time the computation of the sum of the squared errors with respect
+    // to target values, first via the batch function and a reduction in C++,
+    // then via the fused loss kernel.
+    const std::vector<double> targets(10000, 1.);
+    start = high_resolution_clock::now();
+    func_batch(out.data(), llvm_batch_args.data(), 10000);
+    double sse = 0;
+    for (auto i = 0u; i < 10000u; ++i) {
+        sse += (out[i] - targets[i]) * (out[i] - targets[i]);
+    }
+    stop = high_resolution_clock::now();
+    duration = duration_cast<microseconds>(stop - start);
+    std::cout << "Millions of evaluations per second (llvm batch 10000 + SSE): "
+              << 1. / (static_cast<double>(duration.count()) / N) << "M\n";
+
+    auto func_loss = s.fetch_loss("f", lambdifier::llvm_state::loss_type::sse);
+    start = high_resolution_clock::now();
+    const auto sse_fused = func_loss(llvm_batch_args.data(), targets.data(), 10000);
+    stop = high_resolution_clock::now();
+    duration = duration_cast<microseconds>(stop - start);
+    std::cout << "Millions of evaluations per second (llvm fused SSE 10000): "
+              << 1. / (static_cast<double>(duration.count()) / N) << "M\n";
+    std::cout << "SSE (batch + reduction, fused): " << sse << ", " << sse_fused << "\n";
+
     return 0;
 }
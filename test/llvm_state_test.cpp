@@ -0,0 +1,1152 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <lambdifier/llvm_state.hpp>
+#include <lambdifier/math_functions.hpp>
+#include <lambdifier/number.hpp>
+#include <lambdifier/param.hpp>
+#include <lambdifier/variable.hpp>
+
+#include "catch.hpp"
+
+using namespace lambdifier;
+using namespace Catch::literals;
+
+TEST_CASE("incremental compilation")
+{
+    llvm_state s{"incremental"};
+
+    s.add_expression("f", "x"_var * "y"_var, 2);
+    s.compile();
+
+    // Add more expressions after compilation.
+    s.add_expression("g", "x"_var + cos("y"_var), 2);
+    s.compile();
+
+    // The names of the functions already compiled
+    // cannot be re-used.
+    REQUIRE_THROWS_AS(s.add_expression("f", "x"_var), std::invalid_argument);
+
+    s.add_expression("h", "x"_var - "y"_var);
+    s.compile();
+
+    std::vector<double> args{2, 3, 4, 5}, out(2);
+
+    REQUIRE(s.fetch("f")(args.data()) == 6.);
+    REQUIRE(s.fetch("g")(args.data()) == Approx(2. + std::cos(3.)));
+    REQUIRE(s.fetch("h")(args.data()) == -1.);
+
+    s.fetch_batch("f")(out.data(), args.data());
+    REQUIRE(out == std::vector<double>{6., 20.});
+
+    s.fetch_batch("g")(out.data(), args.data());
+    REQUIRE(out[0] == Approx(2. + std::cos(3.)));
+    REQUIRE(out[1] == Approx(4. + std::cos(5.)));
+}
+
+TEST_CASE("parallel compilation")
+{
+    llvm_state s{"parallel"};
+    s.set_compile_threads(4);
+    REQUIRE(s.get_compile_threads() == 4u);
+    REQUIRE_THROWS_AS(s.set_compile_threads(0), std::invalid_argument);
+
+    for (auto i = 0; i < 100; ++i) {
+        s.add_expression("f_" + std::to_string(i), "x"_var * expression{number{i + 1.}} + sin("y"_var), 2);
+    }
+    s.add_taylor("vdp", {"y"_var, (1_num - "x"_var * "x"_var) * "y"_var - "x"_var});
+
+    s.compile();
+
+    std::vector<double> args{2, 3, 4, 5}, out(2);
+    for (auto i = 0; i < 100; ++i) {
+        const auto name = "f_" + std::to_string(i);
+
+        REQUIRE(s.fetch(name)(args.data()) == Approx(2. * (i + 1.) + std::sin(3.)));
+
+        s.fetch_batch(name)(out.data(), args.data());
+        REQUIRE(out[1] == Approx(4. * (i + 1.) + std::sin(5.)));
+    }
+
+    // Check the Taylor integrator against the one
+    // compiled in a single partition.
+    llvm_state s1{"single"};
+    s1.add_taylor("vdp", {"y"_var, (1_num - "x"_var * "x"_var) * "y"_var - "x"_var});
+    s1.compile();
+
+    double st[] = {1, 2}, st1[] = {1, 2};
+    s.fetch_taylor("vdp")(st, .1, 12);
+    s1.fetch_taylor("vdp")(st1, .1, 12);
+    REQUIRE(st[0] == Approx(st1[0]));
+    REQUIRE(st[1] == Approx(st1[1]));
+
+    // Two units defining the same internal
+    // vector math function.
+    llvm_state s2{"simd_parallel"};
+    s2.set_compile_threads(2);
+    s2.set_simd_width(4);
+    s2.add_expression("h0", exp("x"_var) + "y"_var);
+    s2.add_expression("h1", "x"_var * "y"_var);
+    s2.compile();
+    s2.add_expression("h2", exp("x"_var) * "y"_var);
+    s2.add_expression("h3", "x"_var - "y"_var);
+    s2.compile();
+
+    std::vector<double> in(8), out2(4);
+    for (auto i = 0u; i < 8u; ++i) {
+        in[i] = i / 7.;
+    }
+    s2.fetch_batch_n("h2")(out2.data(), in.data(), 4);
+    for (auto i = 0u; i < 4u; ++i) {
+        REQUIRE(out2[i] == Approx(std::exp(in[2u * i]) * in[2u * i + 1u]));
+    }
+    s2.fetch_batch_n("h0")(out2.data(), in.data(), 4);
+    for (auto i = 0u; i < 4u; ++i) {
+        REQUIRE(out2[i] == Approx(std::exp(in[2u * i]) + in[2u * i + 1u]));
+    }
+}
+
+TEST_CASE("object cache")
+{
+    const auto cache_dir = std::filesystem::temp_directory_path() / "lambdifier_object_cache_test";
+    std::filesystem::remove_all(cache_dir);
+
+    auto count_objects = [&cache_dir]() {
+        return std::distance(std::filesystem::directory_iterator(cache_dir), std::filesystem::directory_iterator{});
+    };
+
+    std::vector<double> args{2, 3};
+
+    // Cold start: the object is written to the cache.
+    {
+        llvm_state s{"cache"};
+        REQUIRE(s.get_object_cache_dir().empty());
+        s.set_object_cache_dir(cache_dir.string());
+        REQUIRE(s.get_object_cache_dir() == cache_dir.string());
+
+        s.add_expression("f", "x"_var * exp("y"_var));
+        s.compile();
+        REQUIRE(s.fetch("f")(args.data()) == Approx(2. * std::exp(3.)));
+
+        REQUIRE(count_objects() == 1);
+    }
+
+    // NOTE: backdate the cached object, so that
+    // we can detect if it is written again.
+    const auto obj_path = std::filesystem::directory_iterator(cache_dir)->path();
+    const auto obj_time = std::filesystem::last_write_time(obj_path) - std::chrono::hours(1);
+    std::filesystem::last_write_time(obj_path, obj_time);
+
+    // Warm start: the object is loaded from the cache.
+    {
+        llvm_state s{"cache"};
+        s.set_object_cache_dir(cache_dir.string());
+
+        s.add_expression("f", "x"_var * exp("y"_var));
+        s.compile();
+        REQUIRE(s.fetch("f")(args.data()) == Approx(2. * std::exp(3.)));
+
+        REQUIRE(count_objects() == 1);
+        REQUIRE(std::filesystem::last_write_time(obj_path) == obj_time);
+    }
+
+    // A different expression results in a new object.
+    {
+        llvm_state s{"cache"};
+        s.set_object_cache_dir(cache_dir.string());
+
+        s.add_expression("f", "x"_var * exp("y"_var) + 1_num);
+        s.compile();
+        REQUIRE(s.fetch("f")(args.data()) == Approx(2. * std::exp(3.) + 1.));
+
+        REQUIRE(count_objects() == 2);
+    }
+
+    // The objects of the partitions of a module are found in the cache
+    // also when the module is added by a state with a different name.
+    std::filesystem::remove_all(cache_dir);
+    {
+        llvm_state s{"cache_mt"};
+        s.set_object_cache_dir(cache_dir.string());
+        s.set_compile_threads(2);
+
+        s.add_expression("f", "x"_var * exp("y"_var), 4);
+        s.compile();
+        REQUIRE(s.fetch("f")(args.data()) == Approx(2. * std::exp(3.)));
+    }
+
+    const auto n_objects = count_objects();
+    REQUIRE(n_objects > 1);
+    for (const auto &p : std::filesystem::directory_iterator(cache_dir)) {
+        std::filesystem::last_write_time(p.path(), obj_time);
+    }
+
+    {
+        llvm_state s{"cache_mt_other"};
+        s.set_object_cache_dir(cache_dir.string());
+        s.set_compile_threads(2);
+
+        s.add_expression("f", "x"_var * exp("y"_var), 4);
+        s.compile();
+        REQUIRE(s.fetch("f")(args.data()) == Approx(2. * std::exp(3.)));
+
+        REQUIRE(count_objects() == n_objects);
+        for (const auto &p : std::filesystem::directory_iterator(cache_dir)) {
+            REQUIRE(std::filesystem::last_write_time(p.path()) == obj_time);
+        }
+    }
+
+    std::filesystem::remove_all(cache_dir);
+}
+
+TEST_CASE("aot export")
+{
+    const auto obj_path = std::filesystem::temp_directory_path() / "lambdifier_aot_test.o";
+
+    llvm_state s{"aot"};
+    s.add_expression("f", "x"_var * exp("y"_var));
+    s.emit_object(obj_path.string());
+
+    REQUIRE(std::filesystem::file_size(obj_path) > 0u);
+
+    const auto header = s.dump_c_header();
+    REQUIRE(header.find("double f(double, double)") != std::string::npos);
+    REQUIRE(header.find("double f_vecargs(const double *)") != std::string::npos);
+    REQUIRE(header.find("f.batch\")") != std::string::npos);
+    // The declaration of the function reading the inputs from
+    // separate columns matches the type used in fetch_batch_cols().
+    using cols_decl_t = void(double *, std::uint64_t, const double *const *, const std::uint64_t *, std::uint64_t);
+    static_assert(std::is_same_v<cols_decl_t *, llvm_state::f_batch_cols_ptr>);
+    REQUIRE(header.find("void f_batch_cols(double *, uint64_t, const double *const *, const uint64_t *, uint64_t)")
+            != std::string::npos);
+
+    // The module is still usable after the export.
+    s.compile();
+    std::vector<double> args{2., 3.};
+    REQUIRE(s.fetch("f")(args.data()) == Approx(2. * std::exp(3.)));
+
+    std::filesystem::remove(obj_path);
+}
+
+TEST_CASE("lazy compilation")
+{
+    llvm_state s{"lazy"};
+    REQUIRE(!s.get_lazy());
+    s.set_lazy(true);
+    REQUIRE(s.get_lazy());
+
+    s.add_expression("f", "x"_var * exp("y"_var), 4);
+    s.add_expression("g", "x"_var - "y"_var);
+    s.compile();
+
+    std::vector<double> args{2., 3.};
+    REQUIRE(s.fetch("f")(args.data()) == Approx(2. * std::exp(3.)));
+    REQUIRE(s.fetch("g")(args.data()) == Approx(-1.));
+
+    // Batch mode.
+    std::vector<double> batch_args{1., 2., 3., 4., 5., 6., 7., 8.}, batch_out(4);
+    s.fetch_batch("f")(batch_out.data(), batch_args.data());
+    for (auto i = 0u; i < 4u; ++i) {
+        REQUIRE(batch_out[i] == Approx(batch_args[2u * i] * std::exp(batch_args[2u * i + 1u])));
+    }
+
+    // Add more functions after compilation.
+    s.add_expression("h", "x"_var + "y"_var);
+    s.compile();
+    REQUIRE(s.fetch("h")(args.data()) == Approx(5.));
+}
+
+TEST_CASE("release")
+{
+    llvm_state s{"release"};
+
+    s.add_expression("f", "x"_var * exp("y"_var));
+    const auto u0 = s.compile();
+
+    s.add_expression("g", "x"_var - "y"_var);
+    const auto u1 = s.compile();
+    REQUIRE(u0 != u1);
+
+    std::vector<double> args{2., 3.};
+    REQUIRE(s.fetch("f")(args.data()) == Approx(2. * std::exp(3.)));
+
+    // After the release, the name "f" can be used again.
+    s.release(u0);
+    REQUIRE_THROWS_AS(s.release(u0), std::invalid_argument);
+    s.add_expression("f", "x"_var + "y"_var);
+    s.compile();
+    REQUIRE(s.fetch("f")(args.data()) == Approx(5.));
+
+    // The other unit is not affected.
+    REQUIRE(s.fetch("g")(args.data()) == Approx(-1.));
+
+    // Release a unit whose code was never materialised.
+    s.add_expression("h", "x"_var * "y"_var);
+    s.release(s.compile());
+
+    // Many cycles of compilation and release.
+    for (auto i = 0; i < 100; ++i) {
+        s.add_expression("tmp", "x"_var * "y"_var + expression{number{static_cast<double>(i)}});
+        const auto u = s.compile();
+        REQUIRE(s.fetch("tmp")(args.data()) == Approx(6. + i));
+        s.release(u);
+    }
+
+    // Units compiled in lazy mode cannot be released.
+    s.set_lazy(true);
+    s.add_expression("l", "x"_var * "y"_var);
+    REQUIRE_THROWS_AS(s.release(s.compile()), std::invalid_argument);
+}
+
+TEST_CASE("concurrent siblings")
+{
+    llvm_state s{"main"};
+
+    const auto n_threads = 4u, n_exprs = 20u;
+
+    // Each thread uses its own sibling state
+    // to generate, compile and invoke functions.
+    std::vector<std::thread> threads;
+    std::vector<int> ok(n_threads, 0);
+    for (auto t = 0u; t < n_threads; ++t) {
+        threads.emplace_back([&s, &ok, t]() {
+            llvm_state sib{"sibling_" + std::to_string(t), s};
+
+            std::vector<double> args{2., 3.};
+            bool res = true;
+            for (auto i = 0u; i < n_exprs; ++i) {
+                const auto name = "f_" + std::to_string(t) + "_" + std::to_string(i);
+                sib.add_expression(name, "x"_var * "y"_var + expression{number{static_cast<double>(i)}});
+                sib.compile();
+                res = res && sib.fetch(name)(args.data()) == 6. + i;
+            }
+            ok[t] = res;
+        });
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+
+    for (auto t = 0u; t < n_threads; ++t) {
+        REQUIRE(ok[t] == 1);
+    }
+
+    // The functions compiled by the siblings can
+    // be fetched from the original state.
+    std::vector<double> args{2., 3.};
+    REQUIRE(s.fetch("f_1_3")(args.data()) == Approx(9.));
+
+    // Names are shared among siblings.
+    llvm_state sib{"sibling", s};
+    sib.add_expression("g", "x"_var);
+    sib.compile();
+    REQUIRE_THROWS_AS(s.add_expression("g", "y"_var), std::invalid_argument);
+
+    // A name clash detected at compile time leaves
+    // the state in a usable condition.
+    sib.add_expression("h", "x"_var * 2_num);
+    s.add_expression("h", "x"_var + 3_num);
+    s.add_expression("k", "x"_var * 2_num);
+    sib.compile();
+    REQUIRE_THROWS_AS(s.compile(), std::invalid_argument);
+    REQUIRE(s.dump().find("@k(") == std::string::npos);
+    s.add_expression("k", "x"_var * 2_num);
+    s.compile();
+    REQUIRE(s.fetch("h")(args.data()) == Approx(4.));
+    REQUIRE(s.fetch("k")(args.data()) == Approx(4.));
+
+    // Same for the name of an alias created by the deduplication:
+    // the module is not added to the JIT, and its names can be re-used.
+    s.add_expression("m", "x"_var * 5_num);
+    s.add_expression("n", "x"_var * 5_num);
+    sib.add_expression("n", "x"_var * 6_num);
+    sib.compile();
+    REQUIRE_THROWS_AS(s.compile(), std::invalid_argument);
+    s.add_expression("m", "x"_var * 7_num);
+    s.compile();
+    REQUIRE(s.fetch("m")(args.data()) == Approx(14.));
+    REQUIRE(s.fetch("n")(args.data()) == Approx(12.));
+}
+
+TEST_CASE("target cpu")
+{
+    llvm_state s{"target"};
+    REQUIRE(s.get_target_cpu().empty());
+    REQUIRE(s.get_target_features().empty());
+
+    // Generic x86-64 code.
+    s.set_target_cpu("x86-64");
+    s.set_target_features("+sse2");
+    REQUIRE(s.get_target_cpu() == "x86-64");
+    REQUIRE(s.get_target_features() == "+sse2");
+
+    s.add_expression("f", "x"_var * exp("y"_var), 4);
+    REQUIRE(s.dump().find("\"target-cpu\"=\"x86-64\"") != std::string::npos);
+    s.compile();
+
+    std::vector<double> args{2., 3.};
+    REQUIRE(s.fetch("f")(args.data()) == Approx(2. * std::exp(3.)));
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+TEST_CASE("batch multiversioning")
+{
+    llvm_state s{"multiversioning"};
+    REQUIRE(!s.get_batch_multiversioning());
+    s.set_batch_multiversioning(true);
+    REQUIRE(s.get_batch_multiversioning());
+
+    s.add_expression("f", "x"_var * exp("y"_var), 8);
+
+    const auto ir = s.dump();
+    REQUIRE(ir.find("@f.batch.avx2(") != std::string::npos);
+    REQUIRE(ir.find("@f.batch.avx512(") != std::string::npos);
+
+    s.compile();
+
+    // fetch_batch() picks the best variant
+    // supported by the host.
+    std::vector<double> batch_args(16), batch_out(8);
+    for (auto i = 0u; i < 16u; ++i) {
+        batch_args[i] = i / 16.;
+    }
+    s.fetch_batch("f")(batch_out.data(), batch_args.data());
+    for (auto i = 0u; i < 8u; ++i) {
+        REQUIRE(batch_out[i] == Approx(batch_args[2u * i] * std::exp(batch_args[2u * i + 1u])));
+    }
+}
+
+#endif
+
+TEST_CASE("compile stats")
+{
+    llvm_state s{"stats"};
+    REQUIRE(!s.get_profiling());
+
+    // Without profiling, only the timings of
+    // the IR build and the optimisation are available.
+    s.add_expression("f", "x"_var * exp("y"_var), 4);
+    s.compile();
+    REQUIRE(s.get_compile_stats().ir_build.count() > 0);
+    REQUIRE(s.get_compile_stats().fn_opt.count() > 0);
+    REQUIRE(s.get_compile_stats().codegen.count() == 0);
+    REQUIRE(s.get_compile_stats().pass_timings.empty());
+
+    s.set_profiling(true);
+    REQUIRE(s.get_profiling());
+    s.add_expression("g", "x"_var * exp("y"_var), 4);
+    s.compile();
+    REQUIRE(s.get_compile_stats().ir_build.count() > 0);
+    REQUIRE(s.get_compile_stats().module_opt.count() > 0);
+    REQUIRE(s.get_compile_stats().codegen.count() > 0);
+    REQUIRE(s.get_compile_stats().link.count() > 0);
+    REQUIRE(!s.get_compile_stats().pass_timings.empty());
+    s.set_profiling(false);
+
+    std::vector<double> args{2., 3.};
+    REQUIRE(s.fetch("g")(args.data()) == Approx(2. * std::exp(3.)));
+}
+
+TEST_CASE("gdb support")
+{
+    llvm_state s{"gdb"};
+    REQUIRE(!s.get_gdb_support());
+    s.set_gdb_support(true);
+    REQUIRE(s.get_gdb_support());
+
+    s.add_expression("f", "x"_var * exp("y"_var), 4);
+    const auto u = s.compile();
+
+    std::vector<double> args{2., 3.};
+    REQUIRE(s.fetch("f")(args.data()) == Approx(2. * std::exp(3.)));
+
+    // Releasing the code unregisters it from the debugger.
+    s.release(u);
+
+    s.set_gdb_support(false);
+    REQUIRE(!s.get_gdb_support());
+}
+
+TEST_CASE("async compilation")
+{
+    llvm_state s{"async"};
+
+    s.add_expression("f", "x"_var * exp("y"_var), 4);
+    auto fut = s.compile_async();
+
+    // Keep on generating code while the previous module compiles.
+    s.add_expression("g", "x"_var - "y"_var);
+    // The names of the modules being compiled cannot be re-used,
+    // and their expressions are still deduplicated.
+    REQUIRE_THROWS_AS(s.add_expression("f", "x"_var), std::invalid_argument);
+    s.add_expression("f2", "x"_var * exp("y"_var), 4);
+    auto fut2 = s.compile_async();
+
+    s.add_taylor("vdp", {"y"_var, (1_num - "x"_var * "x"_var) * "y"_var - "x"_var}, 10);
+
+    const auto u = fut.get();
+    fut2.get();
+    s.compile();
+
+    std::vector<double> args{2., 3.};
+    REQUIRE(s.fetch("f")(args.data()) == Approx(2. * std::exp(3.)));
+    REQUIRE(s.fetch("g")(args.data()) == Approx(-1.));
+    REQUIRE(s.fetch("f2")(args.data()) == Approx(2. * std::exp(3.)));
+    REQUIRE(s.fetch_taylor("vdp") != nullptr);
+
+    s.release(u);
+}
+
+TEST_CASE("opt pipelines")
+{
+    llvm_state s{"pipelines"};
+    REQUIRE(s.get_opt_pipeline().empty());
+
+    REQUIRE_THROWS_AS(s.set_opt_pipeline("not-a-pass"), std::invalid_argument);
+    REQUIRE(s.get_opt_pipeline().empty());
+
+    // Default pipeline.
+    s.add_expression("f", "x"_var * cos("y"_var), 4);
+
+    // A different pipeline for each expression.
+    s.set_opt_pipeline("O1");
+    REQUIRE(s.get_opt_pipeline() == "O1");
+    s.add_expression("g", "x"_var + exp("y"_var), 4);
+    // The varargs function has been inlined.
+    REQUIRE(s.dump_function("g.vecargs").find("call double @g(") == std::string::npos);
+
+    s.set_opt_pipeline("O3");
+    s.add_expression("h", "x"_var * "y"_var + sin("x"_var), 4);
+
+    s.set_opt_pipeline("taylor");
+    s.add_expression("k", "x"_var / "y"_var, 4);
+
+    s.set_opt_pipeline("instcombine,gvn");
+    s.add_expression("m", "x"_var - "y"_var, 4);
+
+    s.set_opt_pipeline("");
+    REQUIRE(s.get_opt_pipeline().empty());
+    s.add_expression("n", "x"_var * "x"_var, 4);
+
+    s.compile();
+
+    const std::vector<double> in{1., 2., 3., 4., 5., 6., 7., 8.};
+    std::vector<double> out(4);
+
+    s.fetch_batch("f")(out.data(), in.data());
+    for (auto i = 0u; i < 4u; ++i) {
+        REQUIRE(out[i] == Approx(in[2u * i] * std::cos(in[2u * i + 1u])));
+    }
+    s.fetch_batch("g")(out.data(), in.data());
+    for (auto i = 0u; i < 4u; ++i) {
+        REQUIRE(out[i] == Approx(in[2u * i] + std::exp(in[2u * i + 1u])));
+    }
+    s.fetch_batch("h")(out.data(), in.data());
+    for (auto i = 0u; i < 4u; ++i) {
+        REQUIRE(out[i] == Approx(in[2u * i] * in[2u * i + 1u] + std::sin(in[2u * i])));
+    }
+    s.fetch_batch("k")(out.data(), in.data());
+    for (auto i = 0u; i < 4u; ++i) {
+        REQUIRE(out[i] == Approx(in[2u * i] / in[2u * i + 1u]));
+    }
+    s.fetch_batch("m")(out.data(), in.data());
+    for (auto i = 0u; i < 4u; ++i) {
+        REQUIRE(out[i] == Approx(in[2u * i] - in[2u * i + 1u]));
+    }
+    REQUIRE(s.fetch("n")(in.data()) == Approx(1.));
+}
+
+TEST_CASE("automatic opt level")
+{
+    llvm_state s{"auto_opt"};
+    REQUIRE(!s.get_verbose());
+    s.set_verbose(true);
+    REQUIRE(s.get_verbose());
+
+    // Few calls, minimal cleanup.
+    s.add_expression("f", "x"_var * cos("y"_var), 4, 10);
+    REQUIRE(s.dump().find("\"lambdifier-pipeline\"=\"cleanup\"") != std::string::npos);
+
+    // Many calls, full optimisation.
+    s.add_expression("g", "x"_var * cos("y"_var), 4, 100000000ull);
+    REQUIRE(s.dump().find("\"lambdifier-pipeline\"=\"O3\"") != std::string::npos);
+
+    // With the same number of calls, the
+    // selection depends on the size of the expression.
+    s.add_expression("p", "x"_var * sin("y"_var), 4, 1000);
+    REQUIRE(s.dump().find("\"lambdifier-pipeline\"=\"O1\"") == std::string::npos);
+    auto big = "x"_var;
+    for (auto i = 0; i < 50; ++i) {
+        big = big + cos("y"_var * expression{number{i + 1.}});
+    }
+    s.add_expression("q", big, 4, 1000);
+    REQUIRE(s.dump().find("\"lambdifier-pipeline\"=\"O1\"") != std::string::npos);
+
+    // The user-selected pipeline takes precedence.
+    s.set_opt_pipeline("O1");
+    s.add_expression("h", "x"_var * cos("y"_var), 4, 10);
+    REQUIRE(s.dump().find("\"lambdifier-pipeline\"=\"O1\"") != std::string::npos);
+
+    // The automatic level is capped at the opt level of the state.
+    llvm_state s0{"auto_opt0", 0};
+    s0.add_expression("f", "x"_var * cos("y"_var), 4, 100000000ull);
+    REQUIRE(s0.dump().find("lambdifier-pipeline") == std::string::npos);
+    llvm_state s1{"auto_opt1", 1};
+    s1.add_expression("f", "x"_var * cos("y"_var), 4, 100000000ull);
+    REQUIRE(s1.dump().find("\"lambdifier-pipeline\"=\"O1\"") != std::string::npos);
+    REQUIRE(s1.dump().find("\"lambdifier-pipeline\"=\"O3\"") == std::string::npos);
+
+    s.compile();
+
+    const std::vector<double> in{1., 2., 3., 4., 5., 6., 7., 8.};
+    std::vector<double> out(4);
+
+    for (const auto *name : {"f", "g", "h"}) {
+        s.fetch_batch(name)(out.data(), in.data());
+        for (auto i = 0u; i < 4u; ++i) {
+            REQUIRE(out[i] == Approx(in[2u * i] * std::cos(in[2u * i + 1u])));
+        }
+    }
+
+    s.fetch_batch("q")(out.data(), in.data());
+    for (auto i = 0u; i < 4u; ++i) {
+        auto ref = in[2u * i];
+        for (auto j = 0; j < 50; ++j) {
+            ref += std::cos(in[2u * i + 1u] * (j + 1.));
+        }
+        REQUIRE(out[i] == Approx(ref));
+    }
+}
+
+TEST_CASE("deduplication")
+{
+    llvm_state s{"dedup"};
+
+    s.add_expression("f", "x"_var * cos("y"_var), 2);
+    // Identical expression, no new code.
+    s.add_expression("g", "x"_var * cos("y"_var), 2);
+    REQUIRE(s.dump().find("@g(") == std::string::npos);
+    REQUIRE(!s.dump_function("g").empty());
+    REQUIRE(s.dump_c_header().find("g.batch\")") != std::string::npos);
+    REQUIRE_THROWS_AS(s.add_expression("g", "x"_var), std::invalid_argument);
+
+    // Different batch size, new code.
+    s.add_expression("h", "x"_var * cos("y"_var));
+    REQUIRE(s.dump().find("@h(") != std::string::npos);
+
+    const auto u = s.compile();
+
+    // Alias of a function which has already been compiled.
+    s.add_expression("k", "x"_var * cos("y"_var), 2);
+    s.compile();
+
+    std::vector<double> args{2., 3., 4., 5.}, out(2);
+    for (const auto *name : {"f", "g", "k"}) {
+        REQUIRE(s.fetch(name)(args.data()) == Approx(2. * std::cos(3.)));
+        s.fetch_batch(name)(out.data(), args.data());
+        REQUIRE(out[0] == Approx(2. * std::cos(3.)));
+        REQUIRE(out[1] == Approx(4. * std::cos(5.)));
+    }
+    REQUIRE(s.fetch("h")(args.data()) == Approx(2. * std::cos(3.)));
+
+    // The aliases are released together with the original functions.
+    s.release(u);
+    s.add_expression("g", "x"_var + "y"_var);
+    s.add_expression("m", "x"_var * cos("y"_var), 2);
+    REQUIRE(s.dump().find("@m(") != std::string::npos);
+    s.compile();
+    REQUIRE(s.fetch("g")(args.data()) == Approx(5.));
+    REQUIRE(s.fetch("m")(args.data()) == Approx(2. * std::cos(3.)));
+
+    // Numbers are compared bitwise (0. and -0. are different).
+    // NOTE: the results are not checked, as the sign of zero
+    // is not significant in the fast-math code.
+    s.add_expression("z0", 1_num / ("x"_var * expression{number{0.}}));
+    s.add_expression("z1", 1_num / ("x"_var * expression{number{-0.}}));
+    REQUIRE(s.dump().find("@z1(") != std::string::npos);
+    s.add_expression("z2", 1_num / ("x"_var * expression{number{-0.}}));
+    REQUIRE(s.dump().find("@z2(") == std::string::npos);
+
+    // Different code generation settings, new code.
+    s.set_simd_width(4);
+    s.add_expression("n", "x"_var * cos("y"_var), 2);
+    REQUIRE(s.dump().find("@n(") != std::string::npos);
+    s.set_simd_width(1);
+    s.set_batch_multiversioning(true);
+    s.add_expression("p", "x"_var * cos("y"_var), 2);
+    REQUIRE(s.dump().find("@p(") != std::string::npos);
+    s.compile();
+    REQUIRE(s.fetch("n")(args.data()) == Approx(2. * std::cos(3.)));
+    REQUIRE(s.fetch("p")(args.data()) == Approx(2. * std::cos(3.)));
+}
+
+TEST_CASE("batch soa")
+{
+    llvm_state s{"soa"};
+    REQUIRE(!s.get_batch_soa());
+    s.set_batch_soa(true);
+    REQUIRE(s.get_batch_soa());
+
+    s.add_expression("f", "x"_var * cos("y"_var) + "z"_var, 4);
+    // No SoA function without a batch size.
+    s.add_expression("g", "x"_var - "y"_var);
+    REQUIRE(s.dump().find("@g.batch_soa(") == std::string::npos);
+    s.compile();
+
+    // Variable-major input: first all the x, then all the y, then all the z.
+    const std::vector<double> in{1., 2., 3., 4., 5., 6., 7., 8., 9., 10., 11., 12.};
+    std::vector<double> out(4);
+    s.fetch_batch_soa("f")(out.data(), in.data());
+    for (auto i = 0u; i < 4u; ++i) {
+        REQUIRE(out[i] == Approx(in[i] * std::cos(in[4u + i]) + in[8u + i]));
+    }
+
+    // The AoS function is still available.
+    s.fetch_batch("f")(out.data(), in.data());
+    for (auto i = 0u; i < 4u; ++i) {
+        REQUIRE(out[i] == Approx(in[3u * i] * std::cos(in[3u * i + 1u]) + in[3u * i + 2u]));
+    }
+}
+
+TEST_CASE("runtime batch size")
+{
+    llvm_state s{"batch_n"};
+    s.set_batch_soa(true);
+
+    // No compile-time batch size.
+    s.add_expression("f", "x"_var * cos("y"_var));
+    s.compile();
+
+    // Sizes which are not multiples of the vector width.
+    for (const auto n : {0u, 1u, 3u, 17u, 1000u}) {
+        std::vector<double> in(2u * n), out(n + 1u, -1.);
+        for (auto i = 0u; i < 2u * n; ++i) {
+            in[i] = i / 7.;
+        }
+
+        s.fetch_batch_n("f")(out.data(), in.data(), n);
+        for (auto i = 0u; i < n; ++i) {
+            REQUIRE(out[i] == Approx(in[2u * i] * std::cos(in[2u * i + 1u])));
+        }
+        // Nothing is written past the end.
+        REQUIRE(out[n] == -1.);
+
+        s.fetch_batch_soa_n("f")(out.data(), in.data(), n);
+        for (auto i = 0u; i < n; ++i) {
+            REQUIRE(out[i] == Approx(in[i] * std::cos(in[n + i])));
+        }
+        REQUIRE(out[n] == -1.);
+    }
+}
+
+TEST_CASE("simd codegen")
+{
+    llvm_state s{"simd"};
+    REQUIRE(s.get_simd_width() == 1u);
+    REQUIRE_THROWS_AS(s.set_simd_width(0), std::invalid_argument);
+    REQUIRE_THROWS_AS(s.set_simd_width(3), std::invalid_argument);
+    REQUIRE_THROWS_AS(s.set_simd_width(32), std::invalid_argument);
+    s.set_simd_width(4);
+    REQUIRE(s.get_simd_width() == 4u);
+    s.set_batch_soa(true);
+
+    // Vectorised elementary functions, a vector intrinsic
+    // and a scalarised external function.
+    s.add_expression("f", sin("x"_var) * cos("y"_var) + exp("x"_var - "y"_var) + log("y"_var));
+    s.add_expression("g", pow("x"_var, 2.5_num) + tan("x"_var * "y"_var) + 3_num);
+    s.compile();
+
+    auto f_ref = [](double x, double y) { return std::sin(x) * std::cos(y) + std::exp(x - y) + std::log(y); };
+    auto g_ref = [](double x, double y) { return std::pow(x, 2.5) + std::tan(x * y) + 3; };
+
+    // Sizes which are not multiples of the SIMD width.
+    for (const auto n : {0u, 1u, 3u, 4u, 17u, 1001u}) {
+        std::vector<double> in(2u * n), out(n + 1u, -1.);
+        for (auto i = 0u; i < 2u * n; ++i) {
+            in[i] = (i + 1u) / 13.;
+        }
+
+        s.fetch_batch_n("f")(out.data(), in.data(), n);
+        for (auto i = 0u; i < n; ++i) {
+            REQUIRE(out[i] == Approx(f_ref(in[2u * i], in[2u * i + 1u])));
+        }
+        REQUIRE(out[n] == -1.);
+
+        s.fetch_batch_soa_n("f")(out.data(), in.data(), n);
+        for (auto i = 0u; i < n; ++i) {
+            REQUIRE(out[i] == Approx(f_ref(in[i], in[n + i])));
+        }
+        REQUIRE(out[n] == -1.);
+
+        s.fetch_batch_n("g")(out.data(), in.data(), n);
+        for (auto i = 0u; i < n; ++i) {
+            REQUIRE(out[i] == Approx(g_ref(in[2u * i], in[2u * i + 1u])));
+        }
+        REQUIRE(out[n] == -1.);
+    }
+
+    // Large arguments and special values.
+    const std::vector<double> in{-1E3, 0., 800., -1., 100., 1E-310, -750., std::numeric_limits<double>::infinity()};
+    std::vector<double> out(4);
+    s.fetch_batch_n("f")(out.data(), in.data(), 4);
+    for (auto i = 0u; i < 4u; ++i) {
+        const auto ref = f_ref(in[2u * i], in[2u * i + 1u]);
+        if (std::isnan(ref)) {
+            REQUIRE(std::isnan(out[i]));
+        } else {
+            REQUIRE(out[i] == Approx(ref));
+        }
+    }
+
+    // Arguments beyond the range of the vectorised argument reduction
+    // of sin() and cos(), mixed with small arguments.
+    llvm_state s2{"simd_large_args"};
+    s2.set_simd_width(4);
+    s2.add_expression("h", sin("x"_var) + cos("y"_var));
+    s2.compile();
+    const std::vector<double> in2{1E19, -3E10, .5, 1.5, -7E18, 2., 1E300, -1.};
+    s2.fetch_batch_n("h")(out.data(), in2.data(), 4);
+    for (auto i = 0u; i < 4u; ++i) {
+        REQUIRE(out[i] == Approx(std::sin(in2[2u * i]) + std::cos(in2[2u * i + 1u])));
+    }
+}
+
+TEST_CASE("parallel evaluation")
+{
+    llvm_state s{"parallel"};
+    REQUIRE(s.get_eval_threads() >= 1u);
+    REQUIRE(s.get_eval_chunk_size() == 0u);
+    REQUIRE_THROWS_AS(s.set_eval_threads(0), std::invalid_argument);
+
+    s.add_expression("f", "x"_var * cos("y"_var) + exp("x"_var / 100_num));
+    s.compile();
+
+    REQUIRE_THROWS_AS(s.eval_batch_parallel("g", nullptr, nullptr, 0), std::invalid_argument);
+
+    // Expressions not compiled yet, and released expressions.
+    s.add_expression("g", "x"_var + "y"_var);
+    REQUIRE_THROWS_AS(s.eval_batch_parallel("g", nullptr, nullptr, 0), std::invalid_argument);
+    const auto u = s.compile();
+    s.eval_batch_parallel("g", nullptr, nullptr, 0);
+    s.release(u);
+    REQUIRE_THROWS_AS(s.eval_batch_parallel("g", nullptr, nullptr, 0), std::invalid_argument);
+
+    // A fused kernel re-using the name of a released expression.
+    s.add_expressions("g", {"x"_var, "x"_var * "y"_var * "z"_var});
+    s.compile();
+    REQUIRE_THROWS_AS(s.eval_batch_parallel("g", nullptr, nullptr, 0), std::invalid_argument);
+
+    const auto f_ref = [](double x, double y) { return x * std::cos(y) + std::exp(x / 100); };
+
+    for (const auto n_threads : {1u, 2u, 5u}) {
+        s.set_eval_threads(n_threads);
+        REQUIRE(s.get_eval_threads() == n_threads);
+
+        // Automatic chunk size, and chunk sizes which
+        // do not divide the number of points.
+        for (const auto chunk_size : {0u, 1u, 7u, 1000u}) {
+            s.set_eval_chunk_size(chunk_size);
+
+            for (const auto n : {0u, 1u, 63u, 10001u}) {
+                std::vector<double> in(2u * n), out(n + 1u, -1.);
+                for (auto i = 0u; i < 2u * n; ++i) {
+                    in[i] = i / 11.;
+                }
+
+                s.eval_batch_parallel("f", out.data(), in.data(), n);
+                for (auto i = 0u; i < n; ++i) {
+                    REQUIRE(out[i] == Approx(f_ref(in[2u * i], in[2u * i + 1u])));
+                }
+                // Nothing is written past the end.
+                REQUIRE(out[n] == -1.);
+            }
+        }
+    }
+}
+
+TEST_CASE("multi-output kernels")
+{
+    llvm_state s{"multi"};
+
+    REQUIRE_THROWS_AS(s.add_expressions("f", {}), std::invalid_argument);
+
+    // A vector field sharing the subexpression x * y.
+    auto x = "x"_var, y = "y"_var, z = "z"_var;
+    s.add_expressions("f", {x * y, sin(x * y) + z, x * y - cos(z)}, 4);
+    REQUIRE_THROWS_AS(s.add_expressions("f", {x}), std::invalid_argument);
+    REQUIRE_THROWS_AS(s.add_expression("f", x), std::invalid_argument);
+    s.compile();
+
+    auto check = [](const double *out, const double *in) {
+        REQUIRE(out[0] == Approx(in[0] * in[1]));
+        REQUIRE(out[1] == Approx(std::sin(in[0] * in[1]) + in[2]));
+        REQUIRE(out[2] == Approx(in[0] * in[1] - std::cos(in[2])));
+    };
+
+    const std::vector<double> in{1., 2., 3., 4., 5., 6., 7., 8., 9., 10., 11., 12., 13., 14., 15.};
+    std::vector<double> out(16, -1.);
+
+    s.fetch_multi("f")(out.data(), in.data());
+    check(out.data(), in.data());
+    REQUIRE(out[3] == -1.);
+
+    s.fetch_batch("f")(out.data(), in.data());
+    for (auto i = 0u; i < 4u; ++i) {
+        check(out.data() + 3u * i, in.data() + 3u * i);
+    }
+
+    std::fill(out.begin(), out.end(), -1.);
+    s.fetch_batch_n("f")(out.data(), in.data(), 5);
+    for (auto i = 0u; i < 5u; ++i) {
+        check(out.data() + 3u * i, in.data() + 3u * i);
+    }
+    REQUIRE(out[15] == -1.);
+}
+
+TEST_CASE("strided batches")
+{
+    llvm_state s{"strided"};
+    REQUIRE(!s.get_batch_strided());
+    s.set_batch_strided(true);
+    REQUIRE(s.get_batch_strided());
+
+    s.add_expression("f", "x"_var * cos("y"_var) - "z"_var);
+    s.compile();
+
+    const auto f_ref = [](double x, double y, double z) { return x * std::cos(y) - z; };
+
+    // Rows of an array of structs with 4 members: the
+    // variables are the first 3 members.
+    const std::uint64_t n = 11;
+    std::vector<double> rows(4u * n);
+    for (auto i = 0u; i < rows.size(); ++i) {
+        rows[i] = i / 5.;
+    }
+
+    // Write the output into every other element.
+    std::vector<double> out(2u * n, -1.);
+    s.fetch_batch_strided("f")(out.data(), 2, rows.data(), 4, n);
+    for (auto i = 0u; i < n; ++i) {
+        REQUIRE(out[2u * i] == Approx(f_ref(rows[4u * i], rows[4u * i + 1u], rows[4u * i + 2u])));
+        REQUIRE(out[2u * i + 1u] == -1.);
+    }
+
+    // Columns with different strides: x and z from the
+    // rows above, y from a contiguous array.
+    std::vector<double> y_col(n);
+    for (auto i = 0u; i < n; ++i) {
+        y_col[i] = -1. * i;
+    }
+    const double *cols[] = {rows.data(), y_col.data(), rows.data() + 3};
+    const std::uint64_t strides[] = {4, 1, 4};
+    std::vector<double> out2(n + 1u, -1.);
+    s.fetch_batch_cols("f")(out2.data(), 1, cols, strides, n);
+    for (auto i = 0u; i < n; ++i) {
+        REQUIRE(out2[i] == Approx(f_ref(rows[4u * i], y_col[i], rows[4u * i + 3u])));
+    }
+    REQUIRE(out2[n] == -1.);
+
+    // No evaluations.
+    s.fetch_batch_cols("f")(out2.data(), 1, cols, strides, 0);
+    REQUIRE(out2[0] == Approx(f_ref(rows[0], y_col[0], rows[3])));
+}
+
+TEST_CASE("single precision")
+{
+    llvm_state s{"float"};
+    REQUIRE(!s.get_single_precision());
+    s.set_single_precision(true);
+    REQUIRE(s.get_single_precision());
+    s.set_batch_soa(true);
+
+    // Builtin intrinsics, an external function and a constant.
+    s.add_expression("f", "x"_var * cos("y"_var) + exp("x"_var / 3_num) + tan("y"_var), 4);
+    s.add_expressions("g", {"x"_var + "y"_var, sin("x"_var) * 1.5_num});
+    REQUIRE_THROWS_AS(s.add_taylor("t", {"x"_var}), std::invalid_argument);
+    REQUIRE(s.dump().find("tanf") != std::string::npos);
+    REQUIRE(s.dump().find("llvm.cos.f32") != std::string::npos);
+
+    // Also in SIMD mode.
+    s.set_simd_width(8);
+    s.add_expression("h", sin("x"_var) - log("y"_var));
+    s.compile();
+
+    // The parallel evaluation is available only in double precision.
+    REQUIRE_THROWS_AS(s.eval_batch_parallel("f", nullptr, nullptr, 0), std::invalid_argument);
+
+    const auto f_ref = [](float x, float y) { return x * std::cos(y) + std::exp(x / 3) + std::tan(y); };
+
+    const std::vector<float> in{.1f, .2f, .3f, .4f, .5f, .6f, .7f, .8f, .9f, 1.f, 1.1f, 1.2f, 1.3f, 1.4f, 1.5f, 1.6f,
+                                1.7f, 1.8f, 1.9f, 2.f, 2.1f, 2.2f};
+    std::vector<float> out(11);
+
+    REQUIRE(s.fetch_float("f")(in.data()) == Approx(f_ref(in[0], in[1])).epsilon(1E-5));
+
+    s.fetch_batch_float("f")(out.data(), in.data());
+    for (auto i = 0u; i < 4u; ++i) {
+        REQUIRE(out[i] == Approx(f_ref(in[2u * i], in[2u * i + 1u])).epsilon(1E-5));
+    }
+
+    s.fetch_batch_soa_float("f")(out.data(), in.data());
+    for (auto i = 0u; i < 4u; ++i) {
+        REQUIRE(out[i] == Approx(f_ref(in[i], in[4u + i])).epsilon(1E-5));
+    }
+
+    s.fetch_batch_n_float("f")(out.data(), in.data(), 11);
+    for (auto i = 0u; i < 11u; ++i) {
+        REQUIRE(out[i] == Approx(f_ref(in[2u * i], in[2u * i + 1u])).epsilon(1E-5));
+    }
+
+    s.fetch_batch_n_float("h")(out.data(), in.data(), 11);
+    for (auto i = 0u; i < 11u; ++i) {
+        REQUIRE(out[i] == Approx(std::sin(in[2u * i]) - std::log(in[2u * i + 1u])).epsilon(1E-5));
+    }
+
+    float g_out[2];
+    s.fetch_multi_float("g")(g_out, in.data());
+    REQUIRE(g_out[0] == Approx(in[0] + in[1]).epsilon(1E-5));
+    REQUIRE(g_out[1] == Approx(std::sin(in[0]) * 1.5f).epsilon(1E-5));
+}
+
+TEST_CASE("loss kernels")
+{
+    using lt = llvm_state::loss_type;
+
+    for (const auto simd_width : {1u, 4u}) {
+        llvm_state s{"loss"};
+        REQUIRE(!s.get_loss_kernels());
+        s.set_loss_kernels(true);
+        REQUIRE(s.get_loss_kernels());
+        s.set_simd_width(simd_width);
+
+        s.add_expression("f", "x"_var * sin("y"_var));
+        s.compile();
+
+        for (const auto n : {0u, 1u, 3u, 4u, 11u, 1001u}) {
+            std::vector<double> in(2u * n), target(n);
+            for (auto i = 0u; i < 2u * n; ++i) {
+                in[i] = i / 9.;
+            }
+            for (auto i = 0u; i < n; ++i) {
+                target[i] = i / 10.;
+            }
+
+            double sse = 0, sae = 0, max_abs = 0;
+            for (auto i = 0u; i < n; ++i) {
+                const auto err = in[2u * i] * std::sin(in[2u * i + 1u]) - target[i];
+                sse += err * err;
+                sae += std::abs(err);
+                max_abs = std::max(max_abs, std::abs(err));
+            }
+
+            REQUIRE(s.fetch_loss("f", lt::sse)(in.data(), target.data(), n) == Approx(sse));
+            REQUIRE(s.fetch_loss("f", lt::mae)(in.data(), target.data(), n) == Approx(n == 0u ? 0. : sae / n));
+            REQUIRE(s.fetch_loss("f", lt::max_abs)(in.data(), target.data(), n) == Approx(max_abs));
+        }
+
+        // NaN errors are propagated.
+        std::vector<double> in(2u * 11u, 1.), target(11u, 0.);
+        in[2u * 5u] = std::numeric_limits<double>::quiet_NaN();
+        for (const auto l : {lt::sse, lt::mae, lt::max_abs}) {
+            REQUIRE(std::isnan(s.fetch_loss("f", l)(in.data(), target.data(), 11)));
+        }
+        // NaN targets, in the first lane of the vectorised loop and in the
+        // remainder loop.
+        in[2u * 5u] = 1.;
+        for (const auto idx : {0u, 10u}) {
+            std::fill(target.begin(), target.end(), 0.);
+            target[idx] = std::numeric_limits<double>::quiet_NaN();
+            for (const auto l : {lt::sse, lt::mae, lt::max_abs}) {
+                REQUIRE(std::isnan(s.fetch_loss("f", l)(in.data(), target.data(), 11)));
+            }
+        }
+    }
+}
+
+TEST_CASE("parameters")
+{
+    auto ex = 0_par * sin("x"_var) + 2_par * "y"_var;
+    REQUIRE(ex.get_n_params() == 3u);
+    REQUIRE(("x"_var * 2_num).get_n_params() == 0u);
+    REQUIRE(ex != 1_par * sin("x"_var) + 2_par * "y"_var);
+    REQUIRE(ex.hash() == (0_par * sin("x"_var) + 2_par * "y"_var).hash());
+
+    // Evaluation via the dictionaries and differentiation.
+    std::unordered_map<std::string, double> in_map{{"x", 1.5}, {"y", 2.}, {"par[0]", 3.}, {"par[2]", -4.}};
+    REQUIRE(ex(in_map) == Approx(3. * std::sin(1.5) - 8.));
+    REQUIRE(ex.diff("par[2]")(in_map) == Approx(2.));
+
+    for (const auto simd_width : {1u, 4u}) {
+        llvm_state s{"params"};
+        s.set_simd_width(simd_width);
+        s.set_batch_soa(true);
+        s.set_loss_kernels(true);
+
+        s.add_expression("f", ex, 4);
+        s.compile();
+
+        const std::vector<double> in{1.5, 2.};
+        std::vector<double> pars{3., 0., -4.};
+
+        auto f = s.fetch_par("f");
+        REQUIRE(f(in.data(), pars.data()) == Approx(3. * std::sin(1.5) - 8.));
+
+        // Change the parameters without recompiling.
+        pars = {.5, 0., 2.};
+        REQUIRE(f(in.data(), pars.data()) == Approx(.5 * std::sin(1.5) + 4.));
+
+        const auto n = 11u;
+        std::vector<double> batch_in(2u * n), out(n), out_soa(n), target(n);
+        for (auto i = 0u; i < 2u * n; ++i) {
+            batch_in[i] = i / 7.;
+        }
+
+        s.fetch_batch_par("f")(out.data(), batch_in.data(), pars.data());
+        for (auto i = 0u; i < 4u; ++i) {
+            REQUIRE(out[i] == Approx(f(batch_in.data() + 2u * i, pars.data())));
+        }
+
+        s.fetch_batch_n_par("f")(out.data(), batch_in.data(), n, pars.data());
+        s.fetch_batch_soa_n_par("f")(out_soa.data(), batch_in.data(), n, pars.data());
+        double sse = 0;
+        for (auto i = 0u; i < n; ++i) {
+            REQUIRE(out[i] == Approx(.5 * std::sin(batch_in[2u * i]) + 2. * batch_in[2u * i + 1u]));
+            REQUIRE(out_soa[i] == Approx(.5 * std::sin(batch_in[i]) + 2. * batch_in[n + i]));
+            target[i] = i / 3.;
+            sse += (out[i] - target[i]) * (out[i] - target[i]);
+        }
+
+        REQUIRE(s.fetch_loss_par("f", llvm_state::loss_type::sse)(batch_in.data(), target.data(), n, pars.data())
+                == Approx(sse));
+
+        // Parameters are not supported in fused kernels
+        // and in single precision.
+        REQUIRE_THROWS_AS(s.add_expressions("g", {ex}), std::invalid_argument);
+        s.set_single_precision(true);
+        REQUIRE_THROWS_AS(s.add_expression("g", ex), std::invalid_argument);
+    }
+
+    // Taylor integrator for x' = p * x.
+    llvm_state s{"taylor params"};
+    s.add_taylor("t", {1_par * "x"_var}, 20);
+    s.compile();
+
+    for (const auto p : {.5, -2.}) {
+        const std::vector<double> pars{0., p};
+        double st = 1.5;
+        s.fetch_taylor_par("t")(&st, .1, 20, pars.data());
+        REQUIRE(st == Approx(1.5 * std::exp(p * .1)));
+    }
+}
@@ -0,0 +1,72 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <lambdifier/expression.hpp>
+#include <lambdifier/llvm_state.hpp>
+#include <lambdifier/math_functions.hpp>
+#include <lambdifier/number.hpp>
+#include <lambdifier/variable.hpp>
+
+using namespace lambdifier;
+using namespace std::chrono;
+
+// The expressions of the benchmark, in the style of
+// the ones produced by the genetic programming runs.
+expression make_expression(unsigned i)
+{
+    auto x = "x"_var, y = "y"_var;
+
+    switch (i) {
+        case 0u:
+            return sin(x) * cos(y) + x * y;
+        case 1u:
+            return exp(x - y) * sin(x * 2_num) - log(y + 2_num);
+        default:
+            return exp(sin(x) * cos(y) - 1_num) + log(x * x + 1_num) * sin(y / 3_num);
+    }
+}
+
+// ------------------------------------ Main --------------------------------------
+int main()
+{
+    // Number of evaluations per invocation, and
+    // number of invocations.
+    const std::uint64_t n = 10000;
+    const unsigned n_reps = 100;
+
+    std::vector<double> in(2u * n), out(n);
+    for (std::uint64_t i = 0; i < 2u * n; ++i) {
+        in[i] = std::sin(static_cast<double>(i)) * 10.;
+    }
+
+    for (auto i = 0u; i < 3u; ++i) {
+        const auto ex = make_expression(i);
+        std::cout << "Expression: " << ex << '\n';
+
+        for (const auto width : {1u, 2u, 4u, 8u}) {
+            llvm_state s{"simd_" + std::to_string(width)};
+            s.set_simd_width(width);
+            s.add_expression("f", ex);
+            s.compile();
+
+            auto f = s.fetch_batch_n("f");
+
+            auto start = high_resolution_clock::now();
+            for (auto j = 0u; j < n_reps; ++j) {
+                f(out.data(), in.data(), n);
+            }
+            auto stop = high_resolution_clock::now();
+            const auto ns = duration_cast<nanoseconds>(stop - start).count();
+
+            std::cout << "SIMD width " << width << ", average time per evaluation (nanoseconds): "
+                      << static_cast<double>(ns) / static_cast<double>(n * n_reps) << '\n';
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include <lambdifier/expression.hpp>
+#include <lambdifier/function_call.hpp>
+#include <lambdifier/llvm_state.hpp>
+#include <lambdifier/math_functions.hpp>
+#include <lambdifier/number.hpp>
+#include <lambdifier/tiered_function.hpp>
+#include <lambdifier/variable.hpp>
+
+#include "catch.hpp"
+
+using namespace lambdifier;
+using namespace Catch::literals;
+
+TEST_CASE("tiered function")
+{
+    llvm_state s{"tiered"};
+
+    auto ex = "x"_var * exp("y"_var) + pow("x"_var, 3_num) / sin("z"_var) - sqrt("y"_var) + atan2("x"_var, "z"_var)
+              + log("y"_var) * cos("x"_var) - abs("z"_var);
+    auto ex_eval = [](const std::vector<double> &a) {
+        return a[0] * std::exp(a[1]) + std::pow(a[0], 3.) / std::sin(a[2]) - std::sqrt(a[1])
+               + std::atan2(a[0], a[2]) + std::log(a[1]) * std::cos(a[0]) - std::abs(a[2]);
+    };
+
+    tiered_function tf{ex, s, 10};
+    REQUIRE(tf.get_threshold() == 10u);
+    REQUIRE(tf.get_variables() == std::vector<std::string>{"x", "y", "z"});
+
+    std::vector<double> args{1.1, 2.2, 3.3};
+
+    // Below the threshold, the interpreter is used.
+    for (auto i = 0; i < 9; ++i) {
+        REQUIRE(tf(args.data()) == Approx(ex_eval(args)));
+    }
+    REQUIRE(!tf.is_compiled());
+
+    // This triggers the compilation.
+    REQUIRE(tf(args.data()) == Approx(ex_eval(args)));
+    tf.wait();
+    REQUIRE(tf.is_compiled());
+    REQUIRE(tf(args.data()) == Approx(ex_eval(args)));
+
+    // Immediate compilation.
+    tiered_function tf0{"x"_var - "y"_var, s, 0};
+    tf0.wait();
+    REQUIRE(tf0.is_compiled());
+    REQUIRE(tf0(args.data()) == Approx(-1.1));
+}
+
+TEST_CASE("tiered function generic call")
+{
+    llvm_state s{"tiered generic"};
+
+    // NOTE: fma() is not in the interpreter's fast tables,
+    // thus it is evaluated via its eval_num function.
+    function_call fc{"fma", {"x"_var, "y"_var, "z"_var}};
+    fc.set_type(function_call::type::external);
+    fc.set_eval_num_f([](const std::vector<double> &a) { return std::fma(a[0], a[1], a[2]); });
+
+    tiered_function tf{expression{std::move(fc)} + 1_num, s, 3};
+
+    std::vector<double> args{1.1, 2.2, 3.3};
+
+    for (auto i = 0; i < 2; ++i) {
+        REQUIRE(tf(args.data()) == Approx(std::fma(1.1, 2.2, 3.3) + 1));
+    }
+    REQUIRE(!tf.is_compiled());
+
+    REQUIRE(tf(args.data()) == Approx(std::fma(1.1, 2.2, 3.3) + 1));
+    tf.wait();
+    REQUIRE(tf.is_compiled());
+    REQUIRE(tf(args.data()) == Approx(std::fma(1.1, 2.2, 3.3) + 1));
+
+    // A function which can be neither interpreted nor compiled.
+    function_call bad{"lambdifier_tiered_missing", {"x"_var}};
+    REQUIRE_THROWS_AS((tiered_function{expression{std::move(bad)}, s, 0}), std::invalid_argument);
+}
+
+TEST_CASE("tiered function compile error")
+{
+    llvm_state s{"tiered error"};
+
+    // NOTE: the internal function does not exist in the state,
+    // thus the interpreter works but the compilation fails.
+    function_call fc{"lambdifier_tiered_missing", {"x"_var}};
+    fc.set_eval_num_f([](const std::vector<double> &a) { return 2 * a[0]; });
+
+    tiered_function tf{expression{std::move(fc)}, s, 0};
+    REQUIRE_THROWS_AS(tf.wait(), std::invalid_argument);
+    REQUIRE(!tf.is_compiled());
+
+    // The interpreter is still usable after the failure.
+    const double x = 1.5;
+    REQUIRE(tf(&x) == 3.);
+
+    // The state is still usable as well.
+    tiered_function tf0{"x"_var + 1_num, s, 0};
+    tf0.wait();
+    REQUIRE(tf0.is_compiled());
+    REQUIRE(tf0(&x) == 2.5);
+}